@@ -0,0 +1,949 @@
+/*
+ * KUnit tests of the Nuvoton NAU88L21 audio codec driver
+ *
+ * The codec component is probed on the register model and put on a card
+ * of its own, with the dummy CPU DAI of the ASoC core at the other end of
+ * the link. Streams run through the PCM operations the way user space
+ * drives them, jack events are injected into the model.
+ *
+ * Licensed under the GPL-2.
+ */
+
+#include <kunit/test.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/prandom.h>
+#include <linux/regmap.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <sound/core.h>
+#include <sound/jack.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include <sound/soc.h>
+
+#include "nau8821.h"
+
+/* MCLK of the card when the FLL takes its reference from MCLK */
+#define NAU8821_TEST_MCLK	12288000
+
+/* Hot-plug storm: the event sequence repeats from the seed */
+#define NAU8821_TEST_STORM_SEED		0x8821
+#define NAU8821_TEST_STORM_STEPS	500
+/* longest burst of events injected with the handler held off */
+#define NAU8821_TEST_STORM_BURST_MAX	4
+
+/* Stream cycles timed per bench case, each phase keeps every sample */
+#define NAU8821_TEST_BENCH_CYCLES	64
+
+/* Phases of a stream cycle, as user space drives the PCM */
+enum nau8821_test_phase {
+	NAU8821_TEST_OPEN,
+	NAU8821_TEST_HW_PARAMS,
+	NAU8821_TEST_PREPARE,	/* DAPM power-up of the path */
+	NAU8821_TEST_TRIGGER,
+	NAU8821_TEST_CLOSE,	/* stop, then the power-down at once */
+	NAU8821_TEST_PHASE_NUM,
+};
+
+static const char * const nau8821_test_phase_names[NAU8821_TEST_PHASE_NUM] = {
+	[NAU8821_TEST_OPEN] = "open",
+	[NAU8821_TEST_HW_PARAMS] = "hw_params",
+	[NAU8821_TEST_PREPARE] = "prepare",
+	[NAU8821_TEST_TRIGGER] = "trigger",
+	[NAU8821_TEST_CLOSE] = "close",
+};
+
+/* Call latencies of each phase in ns, saturated */
+struct nau8821_test_bench {
+	u32 lat[NAU8821_TEST_PHASE_NUM][NAU8821_TEST_BENCH_CYCLES];
+};
+
+/*
+ * Bus budget of each operation, counted from its register sequence on the
+ * worst path and including the operations nested in it. A write costs two
+ * address bytes plus two per register, a read likewise. Cached registers
+ * and updates that change nothing cost nothing. Status acknowledges are
+ * counted as in bulk mode, which the jack cases pin. Raise a budget only
+ * together with the change that needs the extra traffic.
+ */
+static const struct nau8821_test_budget {
+	const char *name;
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+} nau8821_test_budgets[NAU8821_OP_NUM] = {
+	/* CLK_DIVIDER and I2S_PCM_CTRL1/2 */
+	[NAU8821_OP_HW_PARAMS] = { "hw_params", 0, 3, 12 },
+	/* one bulk write of CLK_DIVIDER to FLL8 */
+	[NAU8821_OP_FLL_APPLY] = { "fll_apply", 0, 1, 20 },
+	/* status with the jack status, the insertion at manual mode going
+	 * to auto mode and the acknowledge; an ejection or a type costs less
+	 */
+	[NAU8821_OP_INTERRUPT] = { "interrupt", 2, 14, 68 },
+	/* jack status, when the codec kept its registers */
+	[NAU8821_OP_RESUME] = { "resume", 1, 0, 4 },
+	/* the init sequence in one transaction, ADC_RATE and DAC_CTRL1
+	 * sharing a bulk write
+	 */
+	[NAU8821_OP_INIT_REGS] = { "init_regs", 0, 8, 34 },
+	/* one write per DAPM step from the charge pump to the boost driver,
+	 * JAMNODCLOW and TESTDAC
+	 */
+	[NAU8821_OP_HP_POWER_UP] = { "hp_pwr_up", 0, 11, 44 },
+	/* GPIO12_CTRL, JACK_DET_CTRL and INTERRUPT_MASK */
+	[NAU8821_OP_SETUP_IRQ] = { "setup_irq", 0, 3, 12 },
+	/* acknowledge, the manual mode delta and the clock off */
+	[NAU8821_OP_EJECT_JACK] = { "eject_jack", 1, 9, 40 },
+	/* internal clock, auto mode delta, FSCLK cycle and restart */
+	[NAU8821_OP_AUTO_IRQ] = { "auto_irq", 1, 13, 56 },
+	/* one raw read per volatile run, 31 registers in 8 runs */
+	[NAU8821_OP_SNAPSHOT] = { "snapshot", 8, 0, 78 },
+};
+
+/* Per operation counters of the driver, as taken by nau8821_test_traffic() */
+struct nau8821_test_traffic {
+	u64 calls;
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+};
+
+struct nau8821_test {
+	struct device *codec_dev;
+	struct device *card_dev;
+	struct nau8821 *nau8821;
+	struct snd_soc_component *component;
+	struct snd_soc_card card;
+	bool card_registered;
+	struct snd_soc_dai_link link;
+	struct snd_soc_dai_link_component cpu;
+	struct snd_soc_dai_link_component codec;
+	struct snd_soc_dai_link_component platform;
+	struct snd_soc_jack jack;
+	struct snd_pcm *pcm;
+	/* stands in for the PCM device file the streams are opened on */
+	struct file file;
+	/* NAU8821_CLK_FLL_* clock the machine driver sets at hw_params */
+	int fll_src;
+};
+
+/* The devices are not bound, ASoC names components after their driver */
+static struct device_driver nau8821_test_driver = {
+	.name = "nau8821-test",
+};
+
+static unsigned int nau8821_test_freq_in(int fll_src,
+	struct snd_pcm_hw_params *params)
+{
+	switch (fll_src) {
+	case NAU8821_CLK_FLL_MCLK:
+		return NAU8821_TEST_MCLK;
+	case NAU8821_CLK_FLL_BLK:
+		return snd_soc_params_to_bclk(params);
+	default:
+		return params_rate(params);
+	}
+}
+
+/* Clock the codec the way a machine driver does, the FLL at 256 FS */
+static int nau8821_test_link_hw_params(struct snd_pcm_substream *substream,
+	struct snd_pcm_hw_params *params)
+{
+	struct snd_soc_pcm_runtime *rtd = asoc_substream_to_rtd(substream);
+	struct nau8821_test *priv = snd_soc_card_get_drvdata(rtd->card);
+	struct snd_soc_component *component =
+		asoc_rtd_to_codec(rtd, 0)->component;
+	unsigned int freq_in = nau8821_test_freq_in(priv->fll_src, params);
+	int ret;
+
+	ret = snd_soc_component_set_sysclk(component, priv->fll_src, 0,
+		freq_in, SND_SOC_CLOCK_IN);
+	if (ret)
+		return ret;
+
+	return snd_soc_component_set_pll(component, 0, 0, freq_in,
+		params_rate(params) * 256);
+}
+
+static const struct snd_soc_ops nau8821_test_link_ops = {
+	.hw_params = nau8821_test_link_hw_params,
+};
+
+static struct device *nau8821_test_device(const char *name)
+{
+	struct device *dev = root_device_register(name);
+
+	if (IS_ERR(dev))
+		return dev;
+	dev->driver = &nau8821_test_driver;
+
+	return dev;
+}
+
+static int nau8821_test_init(struct kunit *test)
+{
+	struct nau8821_test *priv;
+	struct snd_soc_pcm_runtime *rtd;
+	int ret;
+
+	priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+	test->priv = priv;
+	priv->fll_src = NAU8821_CLK_FLL_FS;
+
+	priv->codec_dev = nau8821_test_device("nau8821-model");
+	if (IS_ERR(priv->codec_dev))
+		return PTR_ERR(priv->codec_dev);
+	priv->card_dev = nau8821_test_device("nau8821-card");
+	if (IS_ERR(priv->card_dev))
+		return PTR_ERR(priv->card_dev);
+	priv->nau8821 = nau8821_model_probe(priv->codec_dev);
+	if (IS_ERR(priv->nau8821))
+		return PTR_ERR(priv->nau8821);
+
+	priv->cpu.name = "snd-soc-dummy";
+	priv->cpu.dai_name = "snd-soc-dummy-dai";
+	priv->platform.name = "snd-soc-dummy";
+	priv->codec.name = dev_name(priv->codec_dev);
+	priv->codec.dai_name = "nau8821-hifi";
+	priv->link.name = "nau8821";
+	priv->link.stream_name = "nau8821";
+	priv->link.cpus = &priv->cpu;
+	priv->link.num_cpus = 1;
+	priv->link.codecs = &priv->codec;
+	priv->link.num_codecs = 1;
+	priv->link.platforms = &priv->platform;
+	priv->link.num_platforms = 1;
+	priv->link.dai_fmt = SND_SOC_DAIFMT_I2S | SND_SOC_DAIFMT_NB_NF |
+		SND_SOC_DAIFMT_CBS_CFS;
+	priv->link.ops = &nau8821_test_link_ops;
+	/* Close powers the path down at once, not after the pop delay */
+	priv->link.ignore_pmdown_time = 1;
+	priv->card.name = "nau8821-test";
+	priv->card.owner = THIS_MODULE;
+	priv->card.dev = priv->card_dev;
+	priv->card.dai_link = &priv->link;
+	priv->card.num_links = 1;
+	snd_soc_card_set_drvdata(&priv->card, priv);
+	ret = snd_soc_register_card(&priv->card);
+	if (ret)
+		return ret;
+	priv->card_registered = true;
+
+	rtd = list_first_entry(&priv->card.rtd_list,
+		struct snd_soc_pcm_runtime, list);
+	priv->pcm = rtd->pcm;
+	priv->component = asoc_rtd_to_codec(rtd, 0)->component;
+
+	ret = snd_soc_card_jack_new(&priv->card, "Headset",
+		SND_JACK_HEADSET | SND_JACK_BTN_0, &priv->jack, NULL, 0);
+	if (ret)
+		return ret;
+
+	return nau8821_enable_jack_detect(priv->component, &priv->jack);
+}
+
+static void nau8821_test_exit(struct kunit *test)
+{
+	struct nau8821_test *priv = test->priv;
+
+	if (!priv)
+		return;
+	if (priv->card_registered)
+		snd_soc_unregister_card(&priv->card);
+	/* The component and the model go with the devres of the codec */
+	if (!IS_ERR_OR_NULL(priv->card_dev))
+		root_device_unregister(priv->card_dev);
+	if (!IS_ERR_OR_NULL(priv->codec_dev))
+		root_device_unregister(priv->codec_dev);
+}
+
+static int nau8821_test_open(struct nau8821_test *priv, int stream,
+	struct snd_pcm_substream **substream)
+{
+	int ret;
+
+	mutex_lock(&priv->pcm->open_mutex);
+	ret = snd_pcm_open_substream(priv->pcm, stream, &priv->file,
+		substream);
+	mutex_unlock(&priv->pcm->open_mutex);
+
+	return ret;
+}
+
+static void nau8821_test_close(struct nau8821_test *priv,
+	struct snd_pcm_substream *substream)
+{
+	mutex_lock(&priv->pcm->open_mutex);
+	snd_pcm_release_substream(substream);
+	mutex_unlock(&priv->pcm->open_mutex);
+}
+
+static void nau8821_test_interval(struct snd_pcm_hw_params *params,
+	snd_pcm_hw_param_t var, unsigned int val)
+{
+	struct snd_interval *i = hw_param_interval(params, var);
+
+	i->min = val;
+	i->max = val;
+	i->openmin = 0;
+	i->openmax = 0;
+	i->integer = 1;
+}
+
+/* Interleaved stereo at @rate and @width, then a stream that never stops
+ * for want of data
+ */
+static int nau8821_test_hw_params(struct snd_pcm_substream *substream,
+	unsigned int rate, unsigned int width)
+{
+	struct snd_pcm_hw_params *params;
+	struct snd_pcm_sw_params sw = {};
+	snd_pcm_format_t format;
+	int ret;
+
+	switch (width) {
+	case 16:
+		format = SNDRV_PCM_FORMAT_S16_LE;
+		break;
+	case 20:
+		format = SNDRV_PCM_FORMAT_S20_3LE;
+		break;
+	case 24:
+		format = SNDRV_PCM_FORMAT_S24_3LE;
+		break;
+	default:
+		format = SNDRV_PCM_FORMAT_S32_LE;
+		break;
+	}
+
+	params = kmalloc(sizeof(*params), GFP_KERNEL);
+	if (!params)
+		return -ENOMEM;
+	_snd_pcm_hw_params_any(params);
+	snd_mask_leave(hw_param_mask(params, SNDRV_PCM_HW_PARAM_ACCESS),
+		(__force unsigned int)SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+	snd_mask_leave(hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT),
+		(__force unsigned int)format);
+	nau8821_test_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS, 2);
+	nau8821_test_interval(params, SNDRV_PCM_HW_PARAM_RATE, rate);
+	ret = snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_HW_PARAMS,
+		params);
+	kfree(params);
+	if (ret)
+		return ret;
+
+	sw.avail_min = substream->runtime->period_size;
+	sw.start_threshold = substream->runtime->buffer_size;
+	sw.stop_threshold = substream->runtime->boundary;
+	sw.boundary = substream->runtime->boundary;
+	sw.period_step = 1;
+
+	return snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_SW_PARAMS, &sw);
+}
+
+static int nau8821_test_prepare(struct snd_pcm_substream *substream)
+{
+	return snd_pcm_kernel_ioctl(substream, SNDRV_PCM_IOCTL_PREPARE, NULL);
+}
+
+static int nau8821_test_trigger(struct snd_pcm_substream *substream,
+	bool start)
+{
+	return snd_pcm_kernel_ioctl(substream, start ?
+		SNDRV_PCM_IOCTL_START : SNDRV_PCM_IOCTL_DROP, NULL);
+}
+
+/* System suspend and resume of the codec, as snd_soc_suspend() does it */
+static void nau8821_test_suspend(struct nau8821_test *priv)
+{
+	snd_power_change_state(priv->card.snd_card, SNDRV_CTL_POWER_D3hot);
+	priv->component->driver->suspend(priv->component);
+}
+
+static void nau8821_test_resume(struct nau8821_test *priv)
+{
+	priv->component->driver->resume(priv->component);
+	snd_power_change_state(priv->card.snd_card, SNDRV_CTL_POWER_D0);
+}
+
+/* Registers the driver sets up at probe and keeps from then on */
+static const unsigned int nau8821_test_kept_regs[] = {
+	NAU8821_REG_BIAS_ADJ,
+	NAU8821_REG_BOOST,
+	NAU8821_REG_LEFT_TIME_SLOT,
+	NAU8821_REG_CLASSG_CTRL,
+	NAU8821_REG_ANALOG_CONTROL_2,
+	NAU8821_REG_RDAC,
+	NAU8821_REG_ADC_RATE,
+	NAU8821_REG_DAC_CTRL1,
+	NAU8821_REG_GPIO12_CTRL,
+	NAU8821_REG_HSVOL_CTRL,
+};
+
+/* The model holds what the regmap cache holds */
+static void nau8821_test_expect_synced(struct kunit *test,
+	struct nau8821_test *priv)
+{
+	unsigned int i, reg, val;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_test_kept_regs); i++) {
+		reg = nau8821_test_kept_regs[i];
+		KUNIT_ASSERT_EQ(test, 0,
+			regmap_read(priv->nau8821->regmap, reg, &val));
+		KUNIT_EXPECT_EQ_MSG(test, val,
+			nau8821_model_reg(priv->nau8821, reg),
+			"register %#x", reg);
+	}
+}
+
+static void nau8821_test_traffic(struct nau8821 *nau8821,
+	struct nau8821_test_traffic *t)
+{
+	const struct nau8821_op_stats *op;
+	unsigned int i;
+
+	spin_lock(&nau8821->stats_lock);
+	for (i = 0; i < NAU8821_OP_NUM; i++) {
+		op = &nau8821->stats.op[i];
+		t[i].calls = op->calls;
+		t[i].reads = op->reads;
+		t[i].writes = op->writes;
+		t[i].bytes = op->bytes;
+	}
+	spin_unlock(&nau8821->stats_lock);
+}
+
+/* Every operation since @from stayed within its budget on every call */
+static void nau8821_test_expect_budget(struct kunit *test,
+	struct nau8821 *nau8821, const struct nau8821_test_traffic *from,
+	const char *step)
+{
+	struct nau8821_test_traffic now[NAU8821_OP_NUM];
+	const struct nau8821_test_budget *budget;
+	unsigned int i;
+	u64 calls;
+
+	nau8821_test_traffic(nau8821, now);
+	for (i = 0; i < NAU8821_OP_NUM; i++) {
+		budget = &nau8821_test_budgets[i];
+		calls = now[i].calls - from[i].calls;
+		KUNIT_EXPECT_LE_MSG(test, now[i].reads - from[i].reads,
+			calls * budget->reads, "%s: %s reads", step,
+			budget->name);
+		KUNIT_EXPECT_LE_MSG(test, now[i].writes - from[i].writes,
+			calls * budget->writes, "%s: %s writes", step,
+			budget->name);
+		KUNIT_EXPECT_LE_MSG(test, now[i].bytes - from[i].bytes,
+			calls * budget->bytes, "%s: %s bytes", step,
+			budget->name);
+	}
+}
+
+static void nau8821_test_probe(struct kunit *test)
+{
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+
+	KUNIT_EXPECT_TRUE(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_BIAS_ADJ) & NAU8821_BIAS_VMID);
+	KUNIT_EXPECT_TRUE(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_BOOST) & NAU8821_GLOBAL_BIAS_EN);
+	KUNIT_EXPECT_EQ(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_ADC_RATE) & NAU8821_ADC_SYNC_DOWN_MASK,
+		NAU8821_ADC_SYNC_DOWN_64);
+	KUNIT_EXPECT_EQ(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_DAC_CTRL1) & NAU8821_DAC_OVERSAMPLE_MASK,
+		NAU8821_DAC_OVERSAMPLE_64);
+	/* interruption set up for the jack detection */
+	KUNIT_EXPECT_TRUE(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_INTERRUPT_MASK) & NAU8821_IRQ_OUTPUT_EN);
+	nau8821_test_expect_synced(test, priv);
+}
+
+static void nau8821_test_hw_params_width(struct kunit *test)
+{
+	static const struct {
+		unsigned int width;
+		unsigned int dl;
+	} widths[] = {
+		{ 16, NAU8821_I2S_DL_16 },
+		{ 20, NAU8821_I2S_DL_20 },
+		{ 24, NAU8821_I2S_DL_24 },
+		{ 32, NAU8821_I2S_DL_32 },
+	};
+	struct nau8821_test *priv = test->priv;
+	struct snd_pcm_substream *substream;
+	unsigned int i;
+	int stream;
+
+	for (stream = 0; stream < 2; stream++)
+		for (i = 0; i < ARRAY_SIZE(widths); i++) {
+			KUNIT_ASSERT_EQ(test, 0,
+				nau8821_test_open(priv, stream, &substream));
+			KUNIT_EXPECT_EQ(test, 0, nau8821_test_hw_params(
+				substream, 48000, widths[i].width));
+			KUNIT_EXPECT_EQ_MSG(test, nau8821_model_reg(
+				priv->nau8821, NAU8821_REG_I2S_PCM_CTRL1) &
+				NAU8821_I2S_DL_MASK, widths[i].dl,
+				"stream %d, %u bits", stream, widths[i].width);
+			nau8821_test_close(priv, substream);
+		}
+}
+
+static void nau8821_test_fll(struct kunit *test)
+{
+	static const int srcs[] = {
+		NAU8821_CLK_FLL_MCLK, NAU8821_CLK_FLL_BLK, NAU8821_CLK_FLL_FS,
+	};
+	static const unsigned int freq_in[] = {
+		NAU8821_TEST_MCLK, 48000 * 16 * 2, 48000,
+	};
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+	struct snd_pcm_substream *substream;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(srcs); i++) {
+		priv->fll_src = srcs[i];
+		KUNIT_ASSERT_EQ(test, 0, nau8821_test_open(priv,
+			SNDRV_PCM_STREAM_PLAYBACK, &substream));
+		KUNIT_EXPECT_EQ(test, 0,
+			nau8821_test_hw_params(substream, 48000, 16));
+		KUNIT_EXPECT_TRUE(test, nau8821->fll_valid);
+		KUNIT_EXPECT_EQ(test, nau8821->fll_freq_in, freq_in[i]);
+		KUNIT_EXPECT_EQ(test, nau8821->fll_freq_out, 48000 * 256);
+		KUNIT_EXPECT_EQ(test, nau8821_model_reg(nau8821,
+			NAU8821_REG_CLK_DIVIDER) & NAU8821_CLK_SRC_MASK,
+			NAU8821_CLK_SRC_VCO);
+		nau8821_test_close(priv, substream);
+	}
+}
+
+/* A register written while suspended reaches the codec even though it
+ * kept its registers, and a power loss is restored from the cache.
+ */
+static void nau8821_test_suspend_resume(struct kunit *test)
+{
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+	unsigned int vol, mask = NAU8821_HPL_VOL_MASK | NAU8821_HPR_VOL_MASK;
+
+	vol = nau8821_model_reg(nau8821, NAU8821_REG_HSVOL_CTRL) & mask;
+	nau8821_test_suspend(priv);
+	KUNIT_EXPECT_EQ(test, 1, snd_soc_component_update_bits(
+		priv->component, NAU8821_REG_HSVOL_CTRL, mask, ~vol & mask));
+	KUNIT_EXPECT_EQ(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_HSVOL_CTRL) & mask, vol);
+	nau8821_test_resume(priv);
+	KUNIT_EXPECT_EQ(test, nau8821_model_reg(nau8821,
+		NAU8821_REG_HSVOL_CTRL) & mask, ~vol & mask);
+	nau8821_test_expect_synced(test, priv);
+
+	nau8821_test_suspend(priv);
+	nau8821_model_power_loss(nau8821);
+	nau8821_test_resume(priv);
+	nau8821_test_expect_synced(test, priv);
+}
+
+static void nau8821_test_jack(struct kunit *test)
+{
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_INSERT);
+	KUNIT_EXPECT_EQ(test, priv->jack.status, SND_JACK_HEADPHONE);
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_EJECT);
+	KUNIT_EXPECT_EQ(test, priv->jack.status, 0);
+
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_INSERT_MIC);
+	KUNIT_EXPECT_EQ(test, priv->jack.status, SND_JACK_HEADSET);
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_PRESS);
+	KUNIT_EXPECT_EQ(test, priv->jack.status,
+		SND_JACK_HEADSET | SND_JACK_BTN_0);
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_RELEASE);
+	KUNIT_EXPECT_EQ(test, priv->jack.status, SND_JACK_HEADSET);
+	nau8821_model_inject(nau8821, NAU8821_MODEL_EV_EJECT);
+	KUNIT_EXPECT_EQ(test, priv->jack.status, 0);
+}
+
+/* The probe sequence, from the register defaults to the armed detection */
+static void nau8821_test_budget_probe(struct kunit *test)
+{
+	struct nau8821_test_traffic none[NAU8821_OP_NUM] = {};
+	struct nau8821_test *priv = test->priv;
+
+	nau8821_test_expect_budget(test, priv->nau8821, none, "probe");
+}
+
+/* hw_params of either stream against the budgets, false if refused */
+static bool nau8821_test_budget_format(struct kunit *test,
+	unsigned int rate, unsigned int width, const char *src)
+{
+	struct nau8821_test_traffic from[NAU8821_OP_NUM];
+	struct nau8821_test *priv = test->priv;
+	struct snd_pcm_substream *substream;
+	bool taken = true;
+	char step[48];
+	int stream;
+
+	for (stream = 0; stream < 2; stream++) {
+		snprintf(step, sizeof(step), "stream %d, %s, %u Hz, %u bits",
+			stream, src, rate, width);
+		KUNIT_ASSERT_EQ(test, 0,
+			nau8821_test_open(priv, stream, &substream));
+		nau8821_test_traffic(priv->nau8821, from);
+		if (nau8821_test_hw_params(substream, rate, width))
+			taken = false;
+		nau8821_test_expect_budget(test, priv->nau8821, from, step);
+		nau8821_test_close(priv, substream);
+	}
+
+	return taken;
+}
+
+/* Every rate and width the DAI takes, with the FLL on each of its
+ * reference inputs
+ */
+static void nau8821_test_budget_hw_params(struct kunit *test)
+{
+	static const int srcs[] = {
+		NAU8821_CLK_FLL_MCLK, NAU8821_CLK_FLL_BLK, NAU8821_CLK_FLL_FS,
+	};
+	static const char * const src_names[] = { "mclk", "bclk", "fs" };
+	static const unsigned int rates[] = {
+		8000, 16000, 32000, 44100, 48000, 96000,
+	};
+	static const unsigned int widths[] = { 16, 20, 24, 32 };
+	struct nau8821_test *priv = test->priv;
+	unsigned int i, j, k, refused = 0;
+
+	for (i = 0; i < ARRAY_SIZE(srcs); i++) {
+		priv->fll_src = srcs[i];
+		for (j = 0; j < ARRAY_SIZE(rates); j++)
+			for (k = 0; k < ARRAY_SIZE(widths); k++)
+				if (!nau8821_test_budget_format(test, rates[j],
+					widths[k], src_names[i]))
+					refused++;
+	}
+	kunit_info(test, "%u formats refused\n", refused);
+}
+
+/* A playback stream started, the headphone driver powered up */
+static void nau8821_test_budget_stream(struct kunit *test)
+{
+	struct nau8821_test_traffic from[NAU8821_OP_NUM];
+	struct nau8821_test *priv = test->priv;
+	struct snd_pcm_substream *substream;
+
+	nau8821_test_traffic(priv->nau8821, from);
+	KUNIT_ASSERT_EQ(test, 0, nau8821_test_open(priv,
+		SNDRV_PCM_STREAM_PLAYBACK, &substream));
+	KUNIT_EXPECT_EQ(test, 0, nau8821_test_hw_params(substream, 48000, 16));
+	KUNIT_EXPECT_EQ(test, 0, nau8821_test_prepare(substream));
+	KUNIT_EXPECT_EQ(test, 0, nau8821_test_trigger(substream, true));
+	nau8821_test_expect_budget(test, priv->nau8821, from, "start");
+	nau8821_test_traffic(priv->nau8821, from);
+	KUNIT_EXPECT_EQ(test, 0, nau8821_test_trigger(substream, false));
+	nau8821_test_close(priv, substream);
+	nau8821_test_expect_budget(test, priv->nau8821, from, "stop");
+}
+
+/* Every jack event, acknowledged in bulk */
+static void nau8821_test_budget_jack(struct kunit *test)
+{
+	static const enum nau8821_model_ev evs[] = {
+		NAU8821_MODEL_EV_INSERT, NAU8821_MODEL_EV_EJECT,
+		NAU8821_MODEL_EV_INSERT_MIC, NAU8821_MODEL_EV_PRESS,
+		NAU8821_MODEL_EV_RELEASE, NAU8821_MODEL_EV_EJECT,
+	};
+	static const char * const ev_names[] = {
+		"insert", "eject", "insert_mic", "press", "release", "eject",
+	};
+	struct nau8821_test_traffic from[NAU8821_OP_NUM];
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+	unsigned int i;
+
+	WRITE_ONCE(nau8821->irq_clear_mode, NAU8821_IRQ_CLEAR_BULK);
+	for (i = 0; i < ARRAY_SIZE(evs); i++) {
+		nau8821_test_traffic(nau8821, from);
+		nau8821_model_inject(nau8821, evs[i]);
+		nau8821_test_expect_budget(test, nau8821, from, ev_names[i]);
+	}
+}
+
+/* A resume of the codec that kept its registers */
+static void nau8821_test_budget_resume(struct kunit *test)
+{
+	struct nau8821_test_traffic from[NAU8821_OP_NUM];
+	struct nau8821_test *priv = test->priv;
+
+	nau8821_test_suspend(priv);
+	nau8821_test_traffic(priv->nau8821, from);
+	nau8821_test_resume(priv);
+	nau8821_test_expect_budget(test, priv->nau8821, from, "resume");
+}
+
+/* Jack of the model the storm has plugged */
+struct nau8821_test_plug {
+	bool jack;
+	bool mic;
+};
+
+/* Pick an event a cable could cause next, given the plugged jack */
+static enum nau8821_model_ev nau8821_test_storm_event(
+	struct nau8821_test_plug *plug, struct rnd_state *rnd)
+{
+	u32 r = prandom_u32_state(rnd);
+
+	if (!plug->jack) {
+		plug->jack = true;
+		plug->mic = r & 0x1;
+		return plug->mic ? NAU8821_MODEL_EV_INSERT_MIC :
+			NAU8821_MODEL_EV_INSERT;
+	}
+	if (plug->mic && (r & 0x3))
+		/* a button click, the release follows as the next event */
+		return NAU8821_MODEL_EV_PRESS;
+	plug->jack = false;
+
+	return NAU8821_MODEL_EV_EJECT;
+}
+
+/*
+ * Randomized hot-plug storm. Each step injects one event, or a burst of
+ * them while the handler is held off the way a wiggled cable bounces
+ * faster than the handler runs. After each step the reported jack must
+ * match the plugged one, and an insertion outside a burst must have been
+ * reported exactly once; at the end the report must match the GPIO.
+ */
+static void nau8821_test_storm(struct kunit *test)
+{
+	struct nau8821_test *priv = test->priv;
+	struct nau8821 *nau8821 = priv->nau8821;
+	struct nau8821_test_plug plug = {};
+	enum nau8821_model_ev ev;
+	struct rnd_state rnd;
+	unsigned int i, j, burst, status, jkdet;
+	u64 inserts;
+	int expected;
+
+	prandom_seed_state(&rnd, NAU8821_TEST_STORM_SEED);
+	for (i = 0; i < NAU8821_TEST_STORM_STEPS; i++) {
+		burst = prandom_u32_state(&rnd) & 0x3 ? 1 : 1 +
+			prandom_u32_state(&rnd) % NAU8821_TEST_STORM_BURST_MAX;
+		if (burst > 1)
+			nau8821_model_hold(nau8821, true);
+		for (j = 0; j < burst; j++) {
+			inserts = nau8821->jack_insert_reports;
+			ev = nau8821_test_storm_event(&plug, &rnd);
+			nau8821_model_inject(nau8821, ev);
+			if (burst == 1 && (ev == NAU8821_MODEL_EV_INSERT ||
+				ev == NAU8821_MODEL_EV_INSERT_MIC))
+				KUNIT_EXPECT_EQ_MSG(test, 1ULL,
+					nau8821->jack_insert_reports - inserts,
+					"step %u: insertion reported", i);
+			if (ev == NAU8821_MODEL_EV_PRESS)
+				nau8821_model_inject(nau8821,
+					NAU8821_MODEL_EV_RELEASE);
+		}
+		if (burst > 1)
+			nau8821_model_hold(nau8821, false);
+		expected = !plug.jack ? 0 :
+			plug.mic ? SND_JACK_HEADSET : SND_JACK_HEADPHONE;
+		KUNIT_ASSERT_EQ_MSG(test, priv->jack.status & SND_JACK_HEADSET,
+			expected, "step %u of the storm seeded %#x", i,
+			NAU8821_TEST_STORM_SEED);
+	}
+
+	status = nau8821_model_reg(nau8821, NAU8821_REG_GENERAL_STATUS);
+	jkdet = nau8821_model_reg(nau8821, NAU8821_REG_JACK_DET_CTRL);
+	KUNIT_EXPECT_EQ(test, !!(status & NAU8821_GPIO2_IN) ==
+		!!(jkdet & NAU8821_JACK_POLARITY),
+		!!(priv->jack.status & SND_JACK_HEADPHONE));
+}
+
+/* Run @phase of a cycle on @stream, the substream opened by the first */
+static int nau8821_test_phase(struct nau8821_test *priv,
+	enum nau8821_test_phase phase, int stream,
+	struct snd_pcm_substream **substream)
+{
+	switch (phase) {
+	case NAU8821_TEST_OPEN:
+		return nau8821_test_open(priv, stream, substream);
+	case NAU8821_TEST_HW_PARAMS:
+		return nau8821_test_hw_params(*substream, 48000, 16);
+	case NAU8821_TEST_PREPARE:
+		return nau8821_test_prepare(*substream);
+	case NAU8821_TEST_TRIGGER:
+		return nau8821_test_trigger(*substream, true);
+	default:
+		nau8821_test_trigger(*substream, false);
+		nau8821_test_close(priv, *substream);
+		*substream = NULL;
+		return 0;
+	}
+}
+
+static int nau8821_test_lat_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank of the sorted samples in us */
+static u32 nau8821_test_pct(const u32 *lat, unsigned int num,
+	unsigned int pct)
+{
+	unsigned int rank = DIV_ROUND_UP(num * pct, 100);
+
+	return lat[rank ? rank - 1 : 0] / NSEC_PER_USEC;
+}
+
+/* Time spent in the DAPM event callbacks of the codec */
+static u64 nau8821_test_dapm_ns(struct nau8821 *nau8821)
+{
+	unsigned int i, dir;
+	u64 ns = 0;
+
+	spin_lock(&nau8821->stats_lock);
+	for (i = 0; i < NAU8821_DAPM_EV_NUM; i++)
+		for (dir = 0; dir < 2; dir++)
+			ns += nau8821->stats.dapm[i][dir].total_ns;
+	spin_unlock(&nau8821->stats_lock);
+
+	return ns;
+}
+
+/*
+ * Time open, hw_params, prepare, trigger and close of the streams in
+ * @streams, a mask of SNDRV_PCM_STREAM_* bits, over the PCM operations.
+ * Each phase covers all the streams; p50, p99 and max go to the log
+ * together with the DAPM callback time per cycle.
+ */
+static void nau8821_test_bench(struct kunit *test, unsigned int streams,
+	const char *name)
+{
+	struct nau8821_test *priv = test->priv;
+	struct snd_pcm_substream *substream[2] = {};
+	struct nau8821_test_bench *bench;
+	unsigned int i, phase;
+	u64 start, dapm_ns;
+	int stream, ret = 0;
+
+	bench = kunit_kzalloc(test, sizeof(*bench), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, bench);
+
+	dapm_ns = nau8821_test_dapm_ns(priv->nau8821);
+	for (i = 0; i < NAU8821_TEST_BENCH_CYCLES; i++)
+		for (phase = 0; phase < NAU8821_TEST_PHASE_NUM; phase++) {
+			start = ktime_get_ns();
+			for (stream = 0; stream < 2 && !ret; stream++)
+				if (streams & BIT(stream))
+					ret = nau8821_test_phase(priv, phase,
+						stream, &substream[stream]);
+			bench->lat[phase][i] =
+				min_t(u64, ktime_get_ns() - start, U32_MAX);
+			if (ret)
+				goto fail;
+		}
+	dapm_ns = nau8821_test_dapm_ns(priv->nau8821) - dapm_ns;
+
+	for (phase = 0; phase < NAU8821_TEST_PHASE_NUM; phase++) {
+		sort(bench->lat[phase], NAU8821_TEST_BENCH_CYCLES,
+			sizeof(u32), nau8821_test_lat_cmp, NULL);
+		kunit_info(test, "%s %-9s p50 %u us, p99 %u us, max %u us\n",
+			name, nau8821_test_phase_names[phase],
+			nau8821_test_pct(bench->lat[phase],
+			NAU8821_TEST_BENCH_CYCLES, 50),
+			nau8821_test_pct(bench->lat[phase],
+			NAU8821_TEST_BENCH_CYCLES, 99),
+			nau8821_test_pct(bench->lat[phase],
+			NAU8821_TEST_BENCH_CYCLES, 100));
+	}
+	kunit_info(test, "%s DAPM callbacks %llu us per cycle\n", name,
+		div_u64(dapm_ns, NAU8821_TEST_BENCH_CYCLES * NSEC_PER_USEC));
+	return;
+
+fail:
+	for (stream = 0; stream < 2; stream++)
+		if (substream[stream])
+			nau8821_test_close(priv, substream[stream]);
+	KUNIT_FAIL(test, "%s cycle %u: %s failed with %d", name, i,
+		nau8821_test_phase_names[phase], ret);
+}
+
+static void nau8821_test_bench_playback(struct kunit *test)
+{
+	nau8821_test_bench(test, BIT(SNDRV_PCM_STREAM_PLAYBACK), "playback");
+}
+
+static void nau8821_test_bench_capture(struct kunit *test)
+{
+	nau8821_test_bench(test, BIT(SNDRV_PCM_STREAM_CAPTURE), "capture");
+}
+
+static void nau8821_test_bench_duplex(struct kunit *test)
+{
+	nau8821_test_bench(test, BIT(SNDRV_PCM_STREAM_PLAYBACK) |
+		BIT(SNDRV_PCM_STREAM_CAPTURE), "duplex");
+}
+
+static struct kunit_case nau8821_model_cases[] = {
+	KUNIT_CASE(nau8821_test_probe),
+	KUNIT_CASE(nau8821_test_hw_params_width),
+	KUNIT_CASE(nau8821_test_fll),
+	KUNIT_CASE(nau8821_test_suspend_resume),
+	KUNIT_CASE(nau8821_test_jack),
+	KUNIT_CASE(nau8821_test_storm),
+	{}
+};
+
+static struct kunit_suite nau8821_model_suite = {
+	.name = "nau8821-model",
+	.init = nau8821_test_init,
+	.exit = nau8821_test_exit,
+	.test_cases = nau8821_model_cases,
+};
+
+static struct kunit_case nau8821_budget_cases[] = {
+	KUNIT_CASE(nau8821_test_budget_probe),
+	KUNIT_CASE(nau8821_test_budget_hw_params),
+	KUNIT_CASE(nau8821_test_budget_stream),
+	KUNIT_CASE(nau8821_test_budget_jack),
+	KUNIT_CASE(nau8821_test_budget_resume),
+	{}
+};
+
+static struct kunit_suite nau8821_budget_suite = {
+	.name = "nau8821-budget",
+	.init = nau8821_test_init,
+	.exit = nau8821_test_exit,
+	.test_cases = nau8821_budget_cases,
+};
+
+static struct kunit_case nau8821_bench_cases[] = {
+	KUNIT_CASE(nau8821_test_bench_playback),
+	KUNIT_CASE(nau8821_test_bench_capture),
+	KUNIT_CASE(nau8821_test_bench_duplex),
+	{}
+};
+
+static struct kunit_suite nau8821_bench_suite = {
+	.name = "nau8821-bench",
+	.init = nau8821_test_init,
+	.exit = nau8821_test_exit,
+	.test_cases = nau8821_bench_cases,
+};
+
+kunit_test_suites(&nau8821_model_suite, &nau8821_budget_suite,
+	&nau8821_bench_suite);
+
+MODULE_DESCRIPTION("KUnit tests of the ASoC nau8821 driver");
+MODULE_LICENSE("GPL v2");
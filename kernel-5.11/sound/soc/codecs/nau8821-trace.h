@@ -0,0 +1,183 @@
+/*
+ * NAU88L21 ALSA SoC audio driver tracepoints
+ *
+ * Copyright 2020 Nuvoton Technology Corp.
+ *
+ * Licensed under the GPL-2.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM nau8821
+
+#if !defined(__NAU8821_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __NAU8821_TRACE_H__
+
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+#include <sound/soc.h>
+#include "nau8821.h"
+
+TRACE_EVENT(nau8821_resume,
+	TP_PROTO(struct device *dev, bool retained, unsigned int regs,
+		unsigned int writes, u64 duration_ns),
+	TP_ARGS(dev, retained, regs, writes, duration_ns),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(bool, retained)
+		__field(unsigned int, regs)
+		__field(unsigned int, writes)
+		__field(u64, duration_ns)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->retained = retained;
+		__entry->regs = regs;
+		__entry->writes = writes;
+		__entry->duration_ns = duration_ns;
+	),
+	TP_printk("%s retained=%d regs=%u writes=%u duration=%lluns",
+		__get_str(name), __entry->retained, __entry->regs,
+		__entry->writes, __entry->duration_ns)
+);
+
+TRACE_EVENT(nau8821_hw_params,
+	TP_PROTO(struct device *dev, int stream, unsigned int rate,
+		unsigned int width, unsigned int osr, int ret),
+	TP_ARGS(dev, stream, rate, width, osr, ret),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(int, stream)
+		__field(unsigned int, rate)
+		__field(unsigned int, width)
+		__field(unsigned int, osr)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->stream = stream;
+		__entry->rate = rate;
+		__entry->width = width;
+		__entry->osr = osr;
+		__entry->ret = ret;
+	),
+	TP_printk("%s stream=%d rate=%u width=%u osr=%u ret=%d",
+		__get_str(name), __entry->stream, __entry->rate,
+		__entry->width, __entry->osr, __entry->ret)
+);
+
+TRACE_EVENT(nau8821_set_fll,
+	TP_PROTO(struct device *dev, unsigned int freq_in,
+		unsigned int freq_out, const struct nau8821_fll *fll,
+		bool cached, int ret),
+	TP_ARGS(dev, freq_in, freq_out, fll, cached, ret),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(unsigned int, freq_in)
+		__field(unsigned int, freq_out)
+		__field(int, mclk_src)
+		__field(int, ratio)
+		__field(int, fll_frac)
+		__field(int, fll_int)
+		__field(int, clk_ref_div)
+		__field(bool, cached)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->freq_in = freq_in;
+		__entry->freq_out = freq_out;
+		__entry->mclk_src = fll->mclk_src;
+		__entry->ratio = fll->ratio;
+		__entry->fll_frac = fll->fll_frac;
+		__entry->fll_int = fll->fll_int;
+		__entry->clk_ref_div = fll->clk_ref_div;
+		__entry->cached = cached;
+		__entry->ret = ret;
+	),
+	TP_printk("%s in=%u out=%u mclk_src=%x ratio=%x fll_frac=%x fll_int=%x clk_ref_div=%x cached=%d ret=%d",
+		__get_str(name), __entry->freq_in, __entry->freq_out,
+		__entry->mclk_src, __entry->ratio, __entry->fll_frac,
+		__entry->fll_int, __entry->clk_ref_div, __entry->cached,
+		__entry->ret)
+);
+
+TRACE_EVENT(nau8821_sysclk,
+	TP_PROTO(struct device *dev, int old_clk_id, int clk_id,
+		unsigned int freq),
+	TP_ARGS(dev, old_clk_id, clk_id, freq),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(int, old_clk_id)
+		__field(int, clk_id)
+		__field(unsigned int, freq)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->old_clk_id = old_clk_id;
+		__entry->clk_id = clk_id;
+		__entry->freq = freq;
+	),
+	TP_printk("%s clk_id=%d->%d freq=%u", __get_str(name),
+		__entry->old_clk_id, __entry->clk_id, __entry->freq)
+);
+
+/* The duration includes the sleeps of the event callback */
+TRACE_EVENT(nau8821_dapm_event,
+	TP_PROTO(struct snd_soc_dapm_widget *w, int event, u64 start_ns),
+	TP_ARGS(w, event, start_ns),
+	TP_STRUCT__entry(
+		__string(name, dev_name(w->dapm->dev))
+		__string(widget, w->name)
+		__field(int, event)
+		__field(u64, duration_ns)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(w->dapm->dev));
+		__assign_str(widget, w->name);
+		__entry->event = event;
+		__entry->duration_ns = ktime_get_ns() - start_ns;
+	),
+	TP_printk("%s widget=%s event=%#x duration=%lluns",
+		__get_str(name), __get_str(widget), __entry->event,
+		__entry->duration_ns)
+);
+
+TRACE_EVENT(nau8821_irq,
+	TP_PROTO(struct device *dev, unsigned int status, unsigned int clear,
+		int event, int prev, int next, int report, int report_mask),
+	TP_ARGS(dev, status, clear, event, prev, next, report, report_mask),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(unsigned int, status)
+		__field(unsigned int, clear)
+		__field(int, event)
+		__field(int, prev)
+		__field(int, next)
+		__field(int, report)
+		__field(int, report_mask)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->status = status;
+		__entry->clear = clear;
+		__entry->event = event;
+		__entry->prev = prev;
+		__entry->next = next;
+		__entry->report = report;
+		__entry->report_mask = report_mask;
+	),
+	TP_printk("%s status=%#x clear=%#x event=%d state=%d->%d report=%#x/%#x",
+		__get_str(name), __entry->status, __entry->clear,
+		__entry->event, __entry->prev, __entry->next,
+		__entry->report, __entry->report_mask)
+);
+
+#endif /* __NAU8821_TRACE_H__ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../sound/soc/codecs
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE nau8821-trace
+#include <trace/define_trace.h>
@@ -16,7 +16,14 @@
 #include <linux/clk.h>
 #include <linux/acpi.h>
 #include <linux/math64.h>
-#include <linux/semaphore.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <sound/initval.h>
 #include <sound/tlv.h>
 #include <sound/core.h>
@@ -26,8 +33,16 @@
 #include <sound/jack.h>
 #include "nau8821.h"
 
+#define CREATE_TRACE_POINTS
+#include "nau8821-trace.h"
+
 #define NUVOTON_CODEC_DAI "nau8821-hifi"
 
+static bool async_resume;
+module_param(async_resume, bool, 0644);
+MODULE_PARM_DESC(async_resume,
+	"Restore the codec registers from a work item on system resume");
+
 #define NAU_FREF_MAX 13500000
 #define NAU_FVCO_MAX 124000000
 #define NAU_FVCO_MIN 90000000
@@ -37,14 +52,10 @@
 
 static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 	int clk_id, unsigned int freq);
-
-struct nau8821_fll {
-	int mclk_src;
-	int ratio;
-	int fll_frac;
-	int fll_int;
-	int clk_ref_div;
-};
+static int nau8821_configure_sysclk_locked(struct nau8821 *nau8821,
+	int clk_id, unsigned int freq);
+static int nau8821_set_fll(struct snd_soc_component *component, int pll_id, int source,
+	unsigned int freq_in, unsigned int freq_out);
 
 struct nau8821_fll_attr {
 	unsigned int param;
@@ -168,6 +179,9 @@ static const struct reg_default nau8821_reg_defaults[] = {
 	{ NAU8821_REG_CLASSG_CTRL, 0x0 },
 	{ NAU8821_REG_IMM_MODE_CTRL, 0x0 },
 	{ NAU8821_REG_IMM_RMS_L, 0x0 },
+	{ NAU8821_REG_FUSE_CTRL2, 0x0 },
+	{ NAU8821_REG_FUSE_CTRL3, 0x0 },
+	{ NAU8821_REG_FUSE_CTRL1, 0x0 },
 	{ NAU8821_REG_OTPDOUT_1, 0xaad8 },
 	{ NAU8821_REG_OTPDOUT_2, 0x0002 },
 	{ NAU8821_REG_MISC_CTRL, 0x0 },
@@ -187,140 +201,522 @@ static const struct reg_default nau8821_reg_defaults[] = {
 	{ NAU8821_REG_CHARGE_PUMP, 0x0 },
 };
 
+static const char * const nau8821_jd_state_names[] = {
+	[NAU8821_JD_IDLE] = "idle",
+	[NAU8821_JD_DETECTING] = "detecting",
+	[NAU8821_JD_DONE] = "done",
+};
+
 /**
- * nau8821_sema_acquire - acquire the semaphore of nau8821
- * @nau8821:  component to register the codec private data with
- * @timeout: how long in jiffies to wait before failure or zero to wait
- * until release
+ * nau8821_jd_start - mark a jack detection in flight
+ * @nau8821: driver private data
  *
- * Attempts to acquire the semaphore with number of jiffies. If no more
- * tasks are allowed to acquire the semaphore, calling this function will
- * put the task to sleep. If the semaphore is not released within the
- * specified number of jiffies, this function returns.
- * If the semaphore is not released within the specified number of jiffies,
- * this function returns -ETIME. If the sleep is interrupted by a signal,
- * this function will return -EINTR. It returns 0 if the semaphore was
- * acquired successfully.
- *
- * Acquires the semaphore without jiffies. Try to acquire the semaphore
- * atomically. Returns 0 if the semaphore has been acquired successfully
- * or 1 if it it cannot be acquired.
+ * Playback configuration issued from now on waits in nau8821_jd_wait()
+ * until the detection finishes.
  */
-static int nau8821_sema_acquire(struct nau8821 *nau8821, long timeout)
+static void nau8821_jd_start(struct nau8821 *nau8821)
 {
-	int ret;
-
 	if (!nau8821->irq)
-		return 1;
+		return;
+	reinit_completion(&nau8821->jd_done);
+	atomic_set(&nau8821->jd_state, NAU8821_JD_DETECTING);
+}
 
-	if (timeout) {
-		ret = down_timeout(&nau8821->jd_sem, timeout);
-		if (ret < 0)
-			dev_warn(nau8821->dev, "Acquire semaphore timeout\n");
-	} else {
-		ret = down_trylock(&nau8821->jd_sem);
-		if (ret)
-			dev_warn(nau8821->dev, "Acquire semaphore fail\n");
+/**
+ * nau8821_jd_finish - end the jack detection in flight
+ * @nau8821: driver private data
+ * @state: NAU8821_JD_DONE when the jack type is known, NAU8821_JD_IDLE
+ * when the detection was abandoned or the jack ejected
+ *
+ * Releases all waiters. It may be called when no detection is in flight.
+ */
+static void nau8821_jd_finish(struct nau8821 *nau8821,
+	enum nau8821_jd_state state)
+{
+	atomic_set(&nau8821->jd_state, state);
+	complete_all(&nau8821->jd_done);
+}
+
+/**
+ * nau8821_jd_wait - wait for the jack detection in flight
+ * @nau8821: driver private data
+ *
+ * Returns at once unless a detection is in flight. Otherwise waits for it
+ * at most jd_wait.timeout_ms, after which the detection is given up so
+ * later callers do not wait again. Every wait is accounted in jd_wait.
+ */
+static void nau8821_jd_wait(struct nau8821 *nau8821)
+{
+	struct nau8821_jd_wait_stats *st = &nau8821->jd_wait;
+	unsigned long left = 1;
+	u64 start, ns = 0;
+	bool waited;
+
+	waited = atomic_read(&nau8821->jd_state) == NAU8821_JD_DETECTING;
+	if (waited) {
+		start = ktime_get_ns();
+		left = wait_for_completion_timeout(&nau8821->jd_done,
+			msecs_to_jiffies(READ_ONCE(st->timeout_ms)));
+		ns = ktime_get_ns() - start;
+		if (!left) {
+			dev_warn(nau8821->dev, "Jack detection timeout\n");
+			if (atomic_cmpxchg(&nau8821->jd_state,
+				NAU8821_JD_DETECTING, NAU8821_JD_IDLE) ==
+				NAU8821_JD_DETECTING)
+				complete_all(&nau8821->jd_done);
+		}
 	}
 
-	return ret;
+	spin_lock(&nau8821->stats_lock);
+	st->calls++;
+	if (waited) {
+		st->waits++;
+		st->total_ns += ns;
+		if (ns > st->max_ns)
+			st->max_ns = ns;
+		if (!left)
+			st->timeouts++;
+	}
+	spin_unlock(&nau8821->stats_lock);
 }
 
 /**
- * nau8821_sema_release - release the semaphore of nau8821
- * @nau8821:  component to register the codec private data with
+ * nau8821_clk_lock - lock the clock and audio interface configuration
+ * @nau8821: driver private data
  *
- * Release the semaphore which may be called from any context and
- * even by tasks which have never called down().
+ * Waits for the jack detection in flight first, the detection itself
+ * never takes the lock.
  */
-static inline void nau8821_sema_release(struct nau8821 *nau8821)
+static void nau8821_clk_lock(struct nau8821 *nau8821)
 {
-	if (!nau8821->irq)
-		return;
-	up(&nau8821->jd_sem);
+	nau8821_jd_wait(nau8821);
+	mutex_lock(&nau8821->clk_lock);
+}
+
+static inline void nau8821_clk_unlock(struct nau8821 *nau8821)
+{
+	mutex_unlock(&nau8821->clk_lock);
 }
 
 /**
- * nau8821_sema_reset - reset the semaphore for nau8821
- * @nau8821:  component to register the codec private data with
+ * nau8821_wait_resume - wait for the registers to be restored after resume
+ * @nau8821: driver private data
  *
- * Reset the counter of the semaphore. Call this function to restart
- * a new round task management.
+ * With async_resume the register cache is written back to the codec by a
+ * work item after system resume. Paths that access the codec wait for it
+ * here rather than racing with the restore.
  */
-static inline void nau8821_sema_reset(struct nau8821 *nau8821)
+static void nau8821_wait_resume(struct nau8821 *nau8821)
+{
+	if (!wait_for_completion_timeout(&nau8821->resume_done,
+		msecs_to_jiffies(NAU8821_RESUME_TIMEOUT_MS)))
+		dev_warn(nau8821->dev, "Register restore still in progress\n");
+}
+
+static const char * const nau8821_op_names[NAU8821_OP_NUM] = {
+	[NAU8821_OP_HW_PARAMS] = "hw_params",
+	[NAU8821_OP_FLL_APPLY] = "fll_apply",
+	[NAU8821_OP_INTERRUPT] = "interrupt",
+	[NAU8821_OP_RESUME] = "resume",
+	[NAU8821_OP_INIT_REGS] = "init_regs",
+	[NAU8821_OP_HP_POWER_UP] = "hp_pwr_up",
+	[NAU8821_OP_SETUP_IRQ] = "setup_irq",
+	[NAU8821_OP_EJECT_JACK] = "eject_jack",
+	[NAU8821_OP_AUTO_IRQ] = "auto_irq",
+	[NAU8821_OP_SNAPSHOT] = "snapshot",
+};
+
+static const char * const nau8821_jack_state_names[NAU8821_JACK_STATE_NUM] = {
+	[NAU8821_JACK_UNKNOWN] = "unknown",
+	[NAU8821_JACK_EJECTED] = "ejected",
+	[NAU8821_JACK_ARMED] = "armed",
+	[NAU8821_JACK_DETECTING] = "detecting",
+	[NAU8821_JACK_HEADPHONE] = "headphone",
+	[NAU8821_JACK_HEADSET] = "headset",
+};
+
+static const char * const nau8821_jack_ev_names[NAU8821_JACK_EV_NUM] = {
+	[NAU8821_JACK_EV_EJECT] = "eject",
+	[NAU8821_JACK_EV_INSERT] = "insert",
+	[NAU8821_JACK_EV_NO_JACK] = "no_jack",
+	[NAU8821_JACK_EV_HEADPHONE] = "headphone",
+	[NAU8821_JACK_EV_HEADSET] = "headset",
+	[NAU8821_JACK_EV_KEY_PRESS] = "key_press",
+	[NAU8821_JACK_EV_KEY_RELEASE] = "key_release",
+};
+
+static const char * const nau8821_jack_det_names[NAU8821_JACK_DET_NUM] = {
+	[NAU8821_JACK_DET_TWO_PASS] = "two_pass",
+	[NAU8821_JACK_DET_ONE_PASS] = "one_pass",
+};
+
+static const char * const nau8821_jack_out_names[NAU8821_JACK_OUT_NUM] = {
+	[NAU8821_JACK_OUT_HEADPHONE] = "headphone",
+	[NAU8821_JACK_OUT_HEADSET] = "headset",
+};
+
+/* Time stamps each detection stage starts and ends at */
+static const struct {
+	const char *name;
+	enum nau8821_jack_mark from, to;
+} nau8821_jack_stages[NAU8821_JACK_STAGE_NUM] = {
+	[NAU8821_JACK_STAGE_MANUAL] = { "manual",
+		NAU8821_JACK_MARK_EDGE, NAU8821_JACK_MARK_MANUAL },
+	[NAU8821_JACK_STAGE_AUTO_SETUP] = { "auto_setup",
+		NAU8821_JACK_MARK_MANUAL, NAU8821_JACK_MARK_AUTO },
+	[NAU8821_JACK_STAGE_MIC_DETECT] = { "mic_detect",
+		NAU8821_JACK_MARK_AUTO, NAU8821_JACK_MARK_MIC_IRQ },
+	[NAU8821_JACK_STAGE_REPORT] = { "report",
+		NAU8821_JACK_MARK_MIC_IRQ, NAU8821_JACK_MARK_REPORT },
+	[NAU8821_JACK_STAGE_TOTAL] = { "total",
+		NAU8821_JACK_MARK_EDGE, NAU8821_JACK_MARK_REPORT },
+};
+
+static const char * const nau8821_fll_src_names[NAU8821_FLL_SRC_NUM] = {
+	[NAU8821_FLL_SRC_MCLK] = "mclk",
+	[NAU8821_FLL_SRC_BCLK] = "bclk",
+	[NAU8821_FLL_SRC_FS] = "fs",
+};
+
+static const char * const nau8821_dapm_ev_names[NAU8821_DAPM_EV_NUM] = {
+	[NAU8821_DAPM_ADC] = "adc",
+	[NAU8821_DAPM_PUMP] = "pump",
+	[NAU8821_DAPM_HP_BOOST] = "hp_boost",
+	[NAU8821_DAPM_OUTPUT_DAC] = "output_dac",
+};
+
+static unsigned int nau8821_hist_bucket(u64 ns)
 {
-	nau8821->jd_sem.count = 1;
+	/* bucket 0 is below 1us, bucket n covers [2^(n-1), 2^n) us */
+	return min_t(unsigned int, fls64(div_u64(ns, NSEC_PER_USEC)),
+		NAU8821_HIST_BUCKETS - 1);
 }
 
-static bool nau8821_readable_reg(struct device *dev, unsigned int reg)
+/* Account a call that took @ns, with stats_lock held */
+static void nau8821_op_stats_add(struct nau8821_op_stats *st, u64 ns)
 {
-	switch (reg) {
-	case NAU8821_REG_RESET ... NAU8821_REG_ENA_CTRL:
-	case NAU8821_REG_CLK_DIVIDER ... NAU8821_REG_FLL8:
-	case NAU8821_REG_JACK_DET_CTRL:
-	case NAU8821_REG_INTERRUPT_MASK ... NAU8821_REG_DMIC_CTRL:
-	case NAU8821_REG_GPIO12_CTRL ... NAU8821_REG_RIGHT_TIME_SLOT:
-	case NAU8821_REG_BIQ0_COF1 ... NAU8821_REG_DAC_CTRL2:
-	case NAU8821_REG_DAC_DGAIN_CTRL ... NAU8821_REG_HSVOL_CTRL:
-	case NAU8821_REG_DACR_CTRL ... NAU8821_REG_DAC_DRC_ATKDCY:
-	case NAU8821_REG_BIQ1_COF1 ... NAU8821_REG_FUSE_CTRL3:
-	case NAU8821_REG_FUSE_CTRL1:
-	case NAU8821_REG_OTPDOUT_1 ... NAU8821_REG_MISC_CTRL:
-	case NAU8821_REG_I2C_DEVICE_ID ... NAU8821_REG_SOFTWARE_RST:
-	case NAU8821_REG_BIAS_ADJ:
-	case NAU8821_REG_TRIM_SETTINGS ... NAU8821_REG_PGA_MUTE:
-	case NAU8821_REG_ANALOG_ADC_1 ... NAU8821_REG_MIC_BIAS:
-	case NAU8821_REG_BOOST ... NAU8821_REG_FEPGA:
-	case NAU8821_REG_PGA_GAIN ... NAU8821_REG_GENERAL_STATUS:
-		return true;
-	default:
-		return false;
+	st->calls++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	st->hist[nau8821_hist_bucket(ns)]++;
+}
+
+/**
+ * nau8821_hist_pct - percentile of the latency histogram
+ * @st: statistics of the operation
+ * @pct: percentile, 1 to 100
+ *
+ * Returns the upper bound in us of the bucket holding the percentile, no
+ * larger than the longest call; the bound is at most twice the real
+ * value.
+ */
+static u64 nau8821_hist_pct(const struct nau8821_op_stats *st,
+	unsigned int pct)
+{
+	u64 rank, seen = 0, max_us;
+	unsigned int i;
+
+	if (!st->calls)
+		return 0;
+	max_us = div_u64(st->max_ns + NSEC_PER_USEC - 1, NSEC_PER_USEC);
+	rank = div_u64(st->calls * pct + 99, 100);
+	for (i = 0; i < NAU8821_HIST_BUCKETS; i++) {
+		seen += st->hist[i];
+		if (seen >= rank)
+			return min_t(u64, 1ULL << i, max_us);
 	}
+
+	return max_us;
 }
 
-static bool nau8821_writeable_reg(struct device *dev, unsigned int reg)
+/* Time a DAPM event callback that started at @start, and trace it */
+static void nau8821_dapm_account(struct nau8821 *nau8821,
+	enum nau8821_dapm_ev ev, struct snd_soc_dapm_widget *w, int event,
+	u64 start)
 {
-	switch (reg) {
-	case NAU8821_REG_RESET ... NAU8821_REG_ENA_CTRL:
-	case NAU8821_REG_CLK_DIVIDER ... NAU8821_REG_FLL8:
-	case NAU8821_REG_JACK_DET_CTRL:
-	case NAU8821_REG_INTERRUPT_MASK:
-	case NAU8821_REG_INT_CLR_KEY_STATUS ... NAU8821_REG_DMIC_CTRL:
-	case NAU8821_REG_GPIO12_CTRL ... NAU8821_REG_RIGHT_TIME_SLOT:
-	case NAU8821_REG_BIQ0_COF1 ... NAU8821_REG_DAC_CTRL2:
-	case NAU8821_REG_DAC_DGAIN_CTRL ... NAU8821_REG_HSVOL_CTRL:
-	case NAU8821_REG_DACR_CTRL ... NAU8821_REG_DAC_DRC_ATKDCY:
-	case NAU8821_REG_BIQ1_COF1 ... NAU8821_REG_IMM_MODE_CTRL:
-	case NAU8821_REG_FUSE_CTRL2 ... NAU8821_REG_FUSE_CTRL3:
-	case NAU8821_REG_FUSE_CTRL1:
-	case NAU8821_REG_MISC_CTRL:
-	case NAU8821_REG_SOFTWARE_RST:
-	case NAU8821_REG_BIAS_ADJ:
-	case NAU8821_REG_TRIM_SETTINGS ... NAU8821_REG_PGA_MUTE:
-	case NAU8821_REG_ANALOG_ADC_1 ... NAU8821_REG_MIC_BIAS:
-	case NAU8821_REG_BOOST ... NAU8821_REG_FEPGA:
-	case NAU8821_REG_PGA_GAIN ... NAU8821_REG_CHARGE_PUMP:
-		return true;
-	default:
-		return false;
+	struct nau8821_op_stats *st =
+		&nau8821->stats.dapm[ev][SND_SOC_DAPM_EVENT_ON(event) ? 0 : 1];
+	u64 ns = ktime_get_ns() - start;
+
+	spin_lock(&nau8821->stats_lock);
+	nau8821_op_stats_add(st, ns);
+	spin_unlock(&nau8821->stats_lock);
+	trace_nau8821_dapm_event(w, event, start);
+}
+
+/* Take a snapshot of the bus totals and the time for @op */
+static void nau8821_op_snapshot(struct nau8821 *nau8821,
+	struct nau8821_op_ctx *ctx, enum nau8821_op op)
+{
+	struct nau8821_io_stats *stats = &nau8821->stats;
+
+	ctx->op = op;
+	spin_lock(&nau8821->stats_lock);
+	ctx->reads = stats->reads;
+	ctx->writes = stats->writes;
+	ctx->bytes = stats->bytes;
+	spin_unlock(&nau8821->stats_lock);
+	ctx->start = ktime_get();
+}
+
+/**
+ * nau8821_op_begin - start accounting a high-level operation
+ * @nau8821: driver private data
+ * @ctx: per-call context, usually on the caller's stack
+ * @op: operation to account to
+ *
+ * The bus traffic of the operation is taken as the difference of the bus
+ * totals between nau8821_op_begin() and nau8821_op_end(). Transfers issued
+ * meanwhile by another path are charged to every operation in flight.
+ *
+ * Operations also attribute the register accesses in the I/O log. Nested
+ * operations restore the outer one when they end; operations running
+ * concurrently in different threads are told apart on a best effort basis.
+ */
+static void nau8821_op_begin(struct nau8821 *nau8821,
+	struct nau8821_op_ctx *ctx, enum nau8821_op op)
+{
+	nau8821_op_snapshot(nau8821, ctx, op);
+	ctx->prev_io_op = READ_ONCE(nau8821->io_op);
+	WRITE_ONCE(nau8821->io_op, op);
+}
+
+/* Account the span between two snapshots of the bus totals */
+static void nau8821_op_account_span(struct nau8821 *nau8821,
+	const struct nau8821_op_ctx *from, const struct nau8821_op_ctx *to,
+	struct nau8821_op_stats *op)
+{
+	u64 ns = ktime_to_ns(ktime_sub(to->start, from->start));
+
+	spin_lock(&nau8821->stats_lock);
+	nau8821_op_stats_add(op, ns);
+	op->reads += to->reads - from->reads;
+	op->writes += to->writes - from->writes;
+	op->bytes += to->bytes - from->bytes;
+	spin_unlock(&nau8821->stats_lock);
+}
+
+static void nau8821_op_account(struct nau8821 *nau8821,
+	struct nau8821_op_ctx *ctx, struct nau8821_op_stats *op)
+{
+	struct nau8821_op_ctx now;
+
+	nau8821_op_snapshot(nau8821, &now, ctx->op);
+	nau8821_op_account_span(nau8821, ctx, &now, op);
+}
+
+static void nau8821_op_end(struct nau8821 *nau8821,
+	struct nau8821_op_ctx *ctx)
+{
+	struct nau8821_op_ctx now;
+
+	nau8821_op_snapshot(nau8821, &now, ctx->op);
+	nau8821_op_account_span(nau8821, ctx, &now,
+		&nau8821->stats.op[ctx->op]);
+	WRITE_ONCE(nau8821->io_op, ctx->prev_io_op);
+}
+
+/*
+ * Register access is described by build-time range tables. With the flat
+ * cache every readable, non-volatile register below must have an entry in
+ * nau8821_reg_defaults, as the cache is never filled from the hardware.
+ */
+static const struct regmap_range nau8821_readable_ranges[] = {
+	regmap_reg_range(NAU8821_REG_RESET, NAU8821_REG_ENA_CTRL),
+	regmap_reg_range(NAU8821_REG_CLK_DIVIDER, NAU8821_REG_FLL8),
+	regmap_reg_range(NAU8821_REG_JACK_DET_CTRL, NAU8821_REG_JACK_DET_CTRL),
+	regmap_reg_range(NAU8821_REG_INTERRUPT_MASK, NAU8821_REG_DMIC_CTRL),
+	regmap_reg_range(NAU8821_REG_GPIO12_CTRL,
+		NAU8821_REG_RIGHT_TIME_SLOT),
+	regmap_reg_range(NAU8821_REG_BIQ0_COF1, NAU8821_REG_DAC_CTRL2),
+	regmap_reg_range(NAU8821_REG_DAC_DGAIN_CTRL, NAU8821_REG_HSVOL_CTRL),
+	regmap_reg_range(NAU8821_REG_DACR_CTRL, NAU8821_REG_DAC_DRC_ATKDCY),
+	regmap_reg_range(NAU8821_REG_BIQ1_COF1, NAU8821_REG_FUSE_CTRL3),
+	regmap_reg_range(NAU8821_REG_FUSE_CTRL1, NAU8821_REG_FUSE_CTRL1),
+	regmap_reg_range(NAU8821_REG_OTPDOUT_1, NAU8821_REG_MISC_CTRL),
+	regmap_reg_range(NAU8821_REG_I2C_DEVICE_ID,
+		NAU8821_REG_SOFTWARE_RST),
+	regmap_reg_range(NAU8821_REG_BIAS_ADJ, NAU8821_REG_BIAS_ADJ),
+	regmap_reg_range(NAU8821_REG_TRIM_SETTINGS, NAU8821_REG_PGA_MUTE),
+	regmap_reg_range(NAU8821_REG_ANALOG_ADC_1, NAU8821_REG_MIC_BIAS),
+	regmap_reg_range(NAU8821_REG_BOOST, NAU8821_REG_FEPGA),
+	regmap_reg_range(NAU8821_REG_PGA_GAIN, NAU8821_REG_GENERAL_STATUS),
+};
+
+static const struct regmap_access_table nau8821_readable_table = {
+	.yes_ranges = nau8821_readable_ranges,
+	.n_yes_ranges = ARRAY_SIZE(nau8821_readable_ranges),
+};
+
+static const struct regmap_range nau8821_writeable_ranges[] = {
+	regmap_reg_range(NAU8821_REG_RESET, NAU8821_REG_ENA_CTRL),
+	regmap_reg_range(NAU8821_REG_CLK_DIVIDER, NAU8821_REG_FLL8),
+	regmap_reg_range(NAU8821_REG_JACK_DET_CTRL, NAU8821_REG_JACK_DET_CTRL),
+	regmap_reg_range(NAU8821_REG_INTERRUPT_MASK,
+		NAU8821_REG_INTERRUPT_MASK),
+	regmap_reg_range(NAU8821_REG_INT_CLR_KEY_STATUS,
+		NAU8821_REG_DMIC_CTRL),
+	regmap_reg_range(NAU8821_REG_GPIO12_CTRL,
+		NAU8821_REG_RIGHT_TIME_SLOT),
+	regmap_reg_range(NAU8821_REG_BIQ0_COF1, NAU8821_REG_DAC_CTRL2),
+	regmap_reg_range(NAU8821_REG_DAC_DGAIN_CTRL, NAU8821_REG_HSVOL_CTRL),
+	regmap_reg_range(NAU8821_REG_DACR_CTRL, NAU8821_REG_DAC_DRC_ATKDCY),
+	regmap_reg_range(NAU8821_REG_BIQ1_COF1, NAU8821_REG_IMM_MODE_CTRL),
+	regmap_reg_range(NAU8821_REG_FUSE_CTRL2, NAU8821_REG_FUSE_CTRL3),
+	regmap_reg_range(NAU8821_REG_FUSE_CTRL1, NAU8821_REG_FUSE_CTRL1),
+	regmap_reg_range(NAU8821_REG_MISC_CTRL, NAU8821_REG_MISC_CTRL),
+	regmap_reg_range(NAU8821_REG_SOFTWARE_RST, NAU8821_REG_SOFTWARE_RST),
+	regmap_reg_range(NAU8821_REG_BIAS_ADJ, NAU8821_REG_BIAS_ADJ),
+	regmap_reg_range(NAU8821_REG_TRIM_SETTINGS, NAU8821_REG_PGA_MUTE),
+	regmap_reg_range(NAU8821_REG_ANALOG_ADC_1, NAU8821_REG_MIC_BIAS),
+	regmap_reg_range(NAU8821_REG_BOOST, NAU8821_REG_FEPGA),
+	regmap_reg_range(NAU8821_REG_PGA_GAIN, NAU8821_REG_CHARGE_PUMP),
+};
+
+static const struct regmap_access_table nau8821_writeable_table = {
+	.yes_ranges = nau8821_writeable_ranges,
+	.n_yes_ranges = ARRAY_SIZE(nau8821_writeable_ranges),
+};
+
+static const struct regmap_range nau8821_volatile_ranges[] = {
+	regmap_reg_range(NAU8821_REG_RESET, NAU8821_REG_RESET),
+	regmap_reg_range(NAU8821_REG_IRQ_STATUS,
+		NAU8821_REG_INT_CLR_KEY_STATUS),
+	regmap_reg_range(NAU8821_REG_BIQ0_COF1, NAU8821_REG_BIQ0_COF10),
+	regmap_reg_range(NAU8821_REG_BIQ1_COF1, NAU8821_REG_BIQ1_COF10),
+	regmap_reg_range(NAU8821_REG_IMM_RMS_L, NAU8821_REG_IMM_RMS_L),
+	regmap_reg_range(NAU8821_REG_OTPDOUT_1, NAU8821_REG_OTPDOUT_2),
+	regmap_reg_range(NAU8821_REG_I2C_DEVICE_ID,
+		NAU8821_REG_SOFTWARE_RST),
+	regmap_reg_range(NAU8821_REG_CHARGE_PUMP_INPUT_READ,
+		NAU8821_REG_GENERAL_STATUS),
+};
+
+static const struct regmap_access_table nau8821_volatile_table = {
+	.yes_ranges = nau8821_volatile_ranges,
+	.n_yes_ranges = ARRAY_SIZE(nau8821_volatile_ranges),
+};
+
+/* Maximum number of distinct registers in one transaction */
+#define NAU8821_TXN_MAX		16
+
+struct nau8821_txn_entry {
+	unsigned int reg;
+	unsigned int mask;
+	unsigned int val;
+};
+
+/*
+ * A register transaction accumulates mask/value updates and flushes them
+ * with one write per register. Registers are committed in the order they
+ * were first updated; a later update of a register already queued is
+ * merged into that first write, so callers must only group updates of
+ * one register whose relative order does not matter to the hardware.
+ */
+struct nau8821_txn {
+	struct regmap *regmap;
+	unsigned int num;
+	int err;
+	struct nau8821_txn_entry entry[NAU8821_TXN_MAX];
+};
+
+static void nau8821_txn_init(struct nau8821_txn *txn, struct regmap *regmap)
+{
+	txn->regmap = regmap;
+	txn->num = 0;
+	txn->err = 0;
+}
+
+static void nau8821_txn_update(struct nau8821_txn *txn, unsigned int reg,
+	unsigned int mask, unsigned int val)
+{
+	struct nau8821_txn_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < txn->num; i++) {
+		e = &txn->entry[i];
+		if (e->reg == reg) {
+			e->val = (e->val & ~mask) | (val & mask);
+			e->mask |= mask;
+			return;
+		}
+	}
+	if (WARN_ON(txn->num == NAU8821_TXN_MAX)) {
+		txn->err = -ENOSPC;
+		return;
 	}
+
+	e = &txn->entry[txn->num];
+	e->reg = reg;
+	e->mask = mask;
+	e->val = val & mask;
+	txn->num++;
 }
 
-static bool nau8821_volatile_reg(struct device *dev, unsigned int reg)
+static int nau8821_txn_flush(struct nau8821_txn *txn, unsigned int reg,
+	u16 *val, unsigned int count)
 {
-	switch (reg) {
-	case NAU8821_REG_RESET:
-	case NAU8821_REG_IRQ_STATUS ... NAU8821_REG_INT_CLR_KEY_STATUS:
-	case NAU8821_REG_BIQ0_COF1 ... NAU8821_REG_BIQ0_COF10:
-	case NAU8821_REG_BIQ1_COF1 ... NAU8821_REG_BIQ1_COF10:
-	case NAU8821_REG_IMM_RMS_L:
-	case NAU8821_REG_OTPDOUT_1 ... NAU8821_REG_OTPDOUT_2:
-	case NAU8821_REG_I2C_DEVICE_ID ... NAU8821_REG_SOFTWARE_RST:
-	case NAU8821_REG_CHARGE_PUMP_INPUT_READ ... NAU8821_REG_GENERAL_STATUS:
-		return true;
-	default:
-		return false;
+	if (count == 1)
+		return regmap_write(txn->regmap, reg, val[0]);
+	return regmap_bulk_write(txn->regmap, reg, val, count);
+}
+
+/**
+ * nau8821_txn_commit - write the accumulated updates to the codec
+ * @txn: transaction to commit
+ *
+ * Cached registers are computed from the register cache and only written
+ * when their value changes; consecutive updates of contiguous registers go
+ * out as a single bulk write. Volatile registers are updated one by one,
+ * after the run queued ahead of them, so the update order is kept.
+ *
+ * Returns 0 on success or negative error code.
+ */
+static int nau8821_txn_commit(struct nau8821_txn *txn)
+{
+	u16 run[NAU8821_TXN_MAX];
+	unsigned int i, cur, run_reg = 0, run_len = 0;
+	struct nau8821_txn_entry *e;
+	int ret = txn->err;
+
+	for (i = 0; i < txn->num && !ret; i++) {
+		e = &txn->entry[i];
+		if (regmap_check_range_table(txn->regmap, e->reg,
+			&nau8821_volatile_table)) {
+			if (run_len) {
+				ret = nau8821_txn_flush(txn, run_reg, run,
+					run_len);
+				run_len = 0;
+				if (ret)
+					break;
+			}
+			ret = regmap_update_bits(txn->regmap, e->reg,
+				e->mask, e->val);
+			continue;
+		}
+		ret = regmap_read(txn->regmap, e->reg, &cur);
+		if (ret)
+			break;
+		if (((cur & ~e->mask) | e->val) == cur)
+			continue;
+
+		if (run_len && e->reg != run_reg + run_len) {
+			ret = nau8821_txn_flush(txn, run_reg, run, run_len);
+			run_len = 0;
+			if (ret)
+				break;
+		}
+		if (!run_len)
+			run_reg = e->reg;
+		run[run_len++] = (cur & ~e->mask) | e->val;
 	}
+	if (!ret && run_len)
+		ret = nau8821_txn_flush(txn, run_reg, run, run_len);
+	txn->num = 0;
+	txn->err = 0;
+
+	return ret;
 }
 
 static int nau8821_biq_coeff_get(struct snd_kcontrol *kcontrol,
@@ -417,22 +813,85 @@ static const struct snd_kcontrol_new nau8821_controls[] = {
 		  nau8821_biq_coeff_get, nau8821_biq_coeff_put),
 };
 
-static int nau8821_left_adc_event(struct snd_soc_dapm_widget *w,
-	struct snd_kcontrol *kcontrol, int event)
+static void nau8821_adc_work(struct work_struct *work)
 {
-	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
-	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	struct nau8821 *nau8821 =
+		container_of(work, struct nau8821, adc_work.work);
+	struct mutex *dapm_mutex = &nau8821->dapm->card->dapm_mutex;
+	struct snd_soc_dapm_widget *w;
+	unsigned int pending;
+
+	/* Widget power and bias level only hold still under the DAPM lock */
+	mutex_lock(dapm_mutex);
+	mutex_lock(&nau8821->adc_lock);
+	pending = nau8821->adc_pending;
+	nau8821->adc_pending = 0;
+	/* The path may have gone down while the window was running */
+	w = nau8821->adc_widget[0];
+	if ((pending & NAU8821_EN_ADCL) && (!w || !w->power))
+		pending &= ~NAU8821_EN_ADCL;
+	w = nau8821->adc_widget[1];
+	if ((pending & NAU8821_EN_ADCR) && (!w || !w->power))
+		pending &= ~NAU8821_EN_ADCR;
+	if (snd_soc_dapm_get_bias_level(nau8821->dapm) == SND_SOC_BIAS_OFF)
+		pending = 0;
+	if (pending)
+		regmap_update_bits(nau8821->regmap, NAU8821_REG_ENA_CTRL,
+			pending, pending);
+	mutex_unlock(&nau8821->adc_lock);
+	mutex_unlock(dapm_mutex);
+}
+
+/**
+ * nau8821_adc_cancel - drop a deferred ADC enable
+ * @nau8821: driver private data
+ *
+ * Called before a path that turns the ADCs off (bias off, jack eject,
+ * suspend), so that the settling work cannot turn them back on behind it.
+ * The bias change runs with the DAPM lock held, which the work takes, so
+ * a running work is not waited for; it finds nothing pending.
+ */
+static void nau8821_adc_cancel(struct nau8821 *nau8821)
+{
+	cancel_delayed_work(&nau8821->adc_work);
+	mutex_lock(&nau8821->adc_lock);
+	nau8821->adc_pending = 0;
+	mutex_unlock(&nau8821->adc_lock);
+}
 
+/**
+ * nau8821_adc_event - enable or disable one ADC channel
+ * @nau8821: driver private data
+ * @event: DAPM event
+ * @en_adc: NAU8821_EN_ADCL or NAU8821_EN_ADCR
+ *
+ * The ADC is enabled once the input path has settled. Rather than
+ * sleeping in the DAPM sequence for every channel, the channel is queued
+ * for a delayed work. A channel powered up while the window is running
+ * restarts it and both are enabled together, so stereo capture waits for
+ * one settling time and the stream start does not block on it. The
+ * stream does run meanwhile: the first NAU8821_ADC_SETTLE_MS of a capture
+ * are silence from the disabled ADC instead of a delayed start.
+ */
+static int nau8821_adc_event(struct nau8821 *nau8821,
+	struct snd_soc_dapm_widget *w, int event, unsigned int en_adc)
+{
 	switch (event) {
 	case SND_SOC_DAPM_POST_PMU:
-		msleep(125);
-		regmap_update_bits(nau8821->regmap, NAU8821_REG_ENA_CTRL,
-			NAU8821_EN_ADCL, NAU8821_EN_ADCL);
+		mutex_lock(&nau8821->adc_lock);
+		nau8821->adc_widget[en_adc == NAU8821_EN_ADCL ? 0 : 1] = w;
+		nau8821->adc_pending |= en_adc;
+		mod_delayed_work(system_wq, &nau8821->adc_work,
+			msecs_to_jiffies(NAU8821_ADC_SETTLE_MS));
+		mutex_unlock(&nau8821->adc_lock);
 		break;
 	case SND_SOC_DAPM_POST_PMD:
+		mutex_lock(&nau8821->adc_lock);
+		nau8821->adc_pending &= ~en_adc;
 		if (!nau8821->irq)
 			regmap_update_bits(nau8821->regmap,
-				NAU8821_REG_ENA_CTRL, NAU8821_EN_ADCL, 0);
+				NAU8821_REG_ENA_CTRL, en_adc, 0);
+		mutex_unlock(&nau8821->adc_lock);
 		break;
 	default:
 		return -EINVAL;
@@ -441,28 +900,52 @@ static int nau8821_left_adc_event(struct snd_soc_dapm_widget *w,
 	return 0;
 }
 
+static int nau8821_left_adc_event(struct snd_soc_dapm_widget *w,
+	struct snd_kcontrol *kcontrol, int event)
+{
+	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
+	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	u64 start = ktime_get_ns();
+	int ret;
+
+	ret = nau8821_adc_event(nau8821, w, event, NAU8821_EN_ADCL);
+	nau8821_dapm_account(nau8821, NAU8821_DAPM_ADC, w, event,
+		start);
+
+	return ret;
+}
+
 static int nau8821_right_adc_event(struct snd_soc_dapm_widget *w,
 	struct snd_kcontrol *kcontrol, int event)
 {
 	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	u64 start = ktime_get_ns();
+	int ret;
 
-	switch (event) {
-	case SND_SOC_DAPM_POST_PMU:
-		msleep(125);
-		regmap_update_bits(nau8821->regmap, NAU8821_REG_ENA_CTRL,
-			NAU8821_EN_ADCR, NAU8821_EN_ADCR);
-		break;
-	case SND_SOC_DAPM_POST_PMD:
-		if (!nau8821->irq)
-			regmap_update_bits(nau8821->regmap,
-				NAU8821_REG_ENA_CTRL, NAU8821_EN_ADCR, 0);
-		break;
-	default:
-		return -EINVAL;
-	}
+	ret = nau8821_adc_event(nau8821, w, event, NAU8821_EN_ADCR);
+	nau8821_dapm_account(nau8821, NAU8821_DAPM_ADC, w, event,
+		start);
 
-	return 0;
+	return ret;
+}
+
+/*
+ * The headphone power-up is timed from the charge pump stage to the last
+ * output stage, i.e. until the first sample can be heard.
+ */
+static void nau8821_hp_power_up_begin(struct nau8821 *nau8821)
+{
+	nau8821_op_begin(nau8821, &nau8821->hp_op, NAU8821_OP_HP_POWER_UP);
+	nau8821->hp_op_active = true;
+}
+
+static void nau8821_hp_power_up_end(struct nau8821 *nau8821)
+{
+	if (!nau8821->hp_op_active)
+		return;
+	nau8821->hp_op_active = false;
+	nau8821_op_end(nau8821, &nau8821->hp_op);
 }
 
 static int nau8821_pump_event(struct snd_soc_dapm_widget *w,
@@ -470,11 +953,17 @@ static int nau8821_pump_event(struct snd_soc_dapm_widget *w,
 {
 	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	u64 start = ktime_get_ns();
 
 	switch (event) {
+	case SND_SOC_DAPM_PRE_PMU:
+		nau8821_hp_power_up_begin(nau8821);
+		break;
 	case SND_SOC_DAPM_POST_PMU:
-		/* Prevent startup click by letting charge pump to ramp up */
-		msleep(10);
+		/* Prevent startup click by letting charge pump to ramp up.
+		 * The chip reports no charge pump ready status to poll.
+		 */
+		usleep_range(10000, 11000);
 		regmap_update_bits(nau8821->regmap, NAU8821_REG_CHARGE_PUMP,
 			NAU8821_JAMNODCLOW, NAU8821_JAMNODCLOW);
 		break;
@@ -485,6 +974,24 @@ static int nau8821_pump_event(struct snd_soc_dapm_widget *w,
 	default:
 		return -EINVAL;
 	}
+	nau8821_dapm_account(nau8821, NAU8821_DAPM_PUMP, w, event,
+		start);
+
+	return 0;
+}
+
+static int nau8821_hp_boost_event(struct snd_soc_dapm_widget *w,
+	struct snd_kcontrol *kcontrol, int event)
+{
+	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
+	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	u64 start = ktime_get_ns();
+
+	/* The boost driver is the last stage of the headphone power-up */
+	if (SND_SOC_DAPM_EVENT_ON(event))
+		nau8821_hp_power_up_end(nau8821);
+	nau8821_dapm_account(nau8821, NAU8821_DAPM_HP_BOOST, w, event,
+		start);
 
 	return 0;
 }
@@ -494,6 +1001,7 @@ static int nau8821_output_dac_event(struct snd_soc_dapm_widget *w,
 {
 	struct snd_soc_component *component = snd_soc_dapm_to_component(w->dapm);
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	u64 start = ktime_get_ns();
 
 	switch (event) {
 	case SND_SOC_DAPM_PRE_PMU:
@@ -508,6 +1016,8 @@ static int nau8821_output_dac_event(struct snd_soc_dapm_widget *w,
 	default:
 		return -EINVAL;
 	}
+	nau8821_dapm_account(nau8821, NAU8821_DAPM_OUTPUT_DAC, w, event,
+		start);
 
 	return 0;
 }
@@ -557,7 +1067,8 @@ static const struct snd_soc_dapm_widget nau8821_dapm_widgets[] = {
 
 	SND_SOC_DAPM_PGA_S("Charge Pump", 1, NAU8821_REG_CHARGE_PUMP,
 		NAU8821_CHANRGE_PUMP_EN_SFT, 0, nau8821_pump_event,
-		SND_SOC_DAPM_POST_PMU | SND_SOC_DAPM_PRE_PMD),
+		SND_SOC_DAPM_PRE_PMU | SND_SOC_DAPM_POST_PMU |
+		SND_SOC_DAPM_PRE_PMD),
 
 	SND_SOC_DAPM_PGA_S("Output Driver R Stage 1", 4,
 		NAU8821_REG_POWER_UP_CONTROL,
@@ -597,7 +1108,8 @@ static const struct snd_soc_dapm_widget nau8821_dapm_widgets[] = {
 
 	/* High current HPOL/R boost driver */
 	SND_SOC_DAPM_PGA_S("HP Boost Driver", 9,
-		NAU8821_REG_BOOST, NAU8821_HP_BOOST_DIS_SFT, 1, NULL, 0),
+		NAU8821_REG_BOOST, NAU8821_HP_BOOST_DIS_SFT, 1,
+		nau8821_hp_boost_event, SND_SOC_DAPM_POST_PMU),
 
 	SND_SOC_DAPM_PGA("Class G", NAU8821_REG_CLASSG_CTRL,
 		NAU8821_CLASSG_EN_SFT, 0, NULL, 0),
@@ -672,9 +1184,14 @@ static int nau8821_hw_params(struct snd_pcm_substream *substream,
 {
 	struct snd_soc_component *component = dai->component;
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
-	unsigned int val_len = 0, osr, ctrl_val, bclk_fs, bclk_div;
+	struct nau8821_op_ctx op;
+	unsigned int val_len = 0, osr, osr_val = 0, ctrl_val, bclk_fs, bclk_div;
+	int ret = 0;
 
-	nau8821_sema_acquire(nau8821, HZ);
+	nau8821_wait_resume(nau8821);
+	/* The wait for a jack detection in flight is not part of the op */
+	nau8821_clk_lock(nau8821);
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_HW_PARAMS);
 
 	/* CLK_DAC or CLK_ADC = OSR * FS
 	 * DAC or ADC clock frequency is defined as Over Sampling Rate (OSR)
@@ -687,9 +1204,10 @@ static int nau8821_hw_params(struct snd_pcm_substream *substream,
 		osr &= NAU8821_DAC_OVERSAMPLE_MASK;
 		if (nau8821_clock_check(nau8821, substream->stream,
 			params_rate(params), osr)) {
-			nau8821_sema_release(nau8821);
-			return -EINVAL;
+			ret = -EINVAL;
+			goto out;
 		}
+		osr_val = osr_dac_sel[osr].osr;
 		regmap_update_bits(nau8821->regmap, NAU8821_REG_CLK_DIVIDER,
 			NAU8821_CLK_DAC_SRC_MASK,
 			osr_dac_sel[osr].clk_src << NAU8821_CLK_DAC_SRC_SFT);
@@ -698,9 +1216,10 @@ static int nau8821_hw_params(struct snd_pcm_substream *substream,
 		osr &= NAU8821_ADC_SYNC_DOWN_MASK;
 		if (nau8821_clock_check(nau8821, substream->stream,
 			params_rate(params), osr)) {
-			nau8821_sema_release(nau8821);
-			return -EINVAL;
+			ret = -EINVAL;
+			goto out;
 		}
+		osr_val = osr_adc_sel[osr].osr;
 		regmap_update_bits(nau8821->regmap, NAU8821_REG_CLK_DIVIDER,
 			NAU8821_CLK_ADC_SRC_MASK,
 			osr_adc_sel[osr].clk_src << NAU8821_CLK_ADC_SRC_SFT);
@@ -718,8 +1237,8 @@ static int nau8821_hw_params(struct snd_pcm_substream *substream,
 		else if (bclk_fs <= 128)
 			bclk_div = 0;
 		else {
-			nau8821_sema_release(nau8821);
-			return -EINVAL;
+			ret = -EINVAL;
+			goto out;
 		}
 		regmap_update_bits(nau8821->regmap, NAU8821_REG_I2S_PCM_CTRL2,
 			NAU8821_I2S_LRC_DIV_MASK | NAU8821_I2S_BLK_DIV_MASK,
@@ -740,16 +1259,20 @@ static int nau8821_hw_params(struct snd_pcm_substream *substream,
 		val_len |= NAU8821_I2S_DL_32;
 		break;
 	default:
-		nau8821_sema_release(nau8821);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
 	regmap_update_bits(nau8821->regmap, NAU8821_REG_I2S_PCM_CTRL1,
 		NAU8821_I2S_DL_MASK, val_len);
 
-	nau8821_sema_release(nau8821);
+out:
+	nau8821_op_end(nau8821, &op);
+	nau8821_clk_unlock(nau8821);
+	trace_nau8821_hw_params(nau8821->dev, substream->stream,
+		params_rate(params), params_width(params), osr_val, ret);
 
-	return 0;
+	return ret;
 }
 
 static int nau8821_set_dai_fmt(struct snd_soc_dai *codec_dai, unsigned int fmt)
@@ -758,6 +1281,7 @@ static int nau8821_set_dai_fmt(struct snd_soc_dai *codec_dai, unsigned int fmt)
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 	unsigned int ctrl1_val = 0, ctrl2_val = 0;
 
+	nau8821_wait_resume(nau8821);
 	switch (fmt & SND_SOC_DAIFMT_MASTER_MASK) {
 	case SND_SOC_DAIFMT_CBM_CFM:
 		ctrl2_val |= NAU8821_I2S_MS_MASTER;
@@ -799,7 +1323,7 @@ static int nau8821_set_dai_fmt(struct snd_soc_dai *codec_dai, unsigned int fmt)
 		return -EINVAL;
 	}
 
-	nau8821_sema_acquire(nau8821, HZ);
+	nau8821_clk_lock(nau8821);
 
 	regmap_update_bits(nau8821->regmap, NAU8821_REG_I2S_PCM_CTRL1,
 		NAU8821_I2S_DL_MASK | NAU8821_I2S_DF_MASK |
@@ -807,7 +1331,7 @@ static int nau8821_set_dai_fmt(struct snd_soc_dai *codec_dai, unsigned int fmt)
 	regmap_update_bits(nau8821->regmap, NAU8821_REG_I2S_PCM_CTRL2,
 		NAU8821_I2S_MS_MASK, ctrl2_val);
 
-	nau8821_sema_release(nau8821);
+	nau8821_clk_unlock(nau8821);
 
 	return 0;
 }
@@ -824,7 +1348,22 @@ static int nau8821_digital_mute(struct snd_soc_dai *dai, int mute, int direction
 		NAU8821_REG_MUTE_CTRL, NAU8821_DAC_SOFT_MUTE, val);
 }
 
+/* Opening a stream waits for the register restore after resume, rather
+ * than the first configuration callback.
+ */
+static int nau8821_startup(struct snd_pcm_substream *substream,
+	struct snd_soc_dai *dai)
+{
+	struct snd_soc_component *component = dai->component;
+	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+
+	nau8821_wait_resume(nau8821);
+
+	return 0;
+}
+
 static const struct snd_soc_dai_ops nau8821_dai_ops = {
+	.startup = nau8821_startup,
 	.hw_params = nau8821_hw_params,
 	.set_fmt = nau8821_set_dai_fmt,
 	.mute_stream = nau8821_digital_mute,
@@ -853,15 +1392,18 @@ static struct snd_soc_dai_driver nau8821_dai = {
 	.ops = &nau8821_dai_ops,
 };
 
+static int nau8821_read_status(struct nau8821 *nau8821,
+	const unsigned int *regs, unsigned int *vals, int num);
 
-static bool nau8821_is_jack_inserted(struct regmap *regmap)
+static bool nau8821_jack_status_inserted(struct regmap *regmap,
+	unsigned int status)
 {
 	bool active_high, is_high;
-	int status, jkdet;
+	int jkdet;
 
+	/* JACK_DET_CTRL is not volatile and comes from the cache */
 	regmap_read(regmap, NAU8821_REG_JACK_DET_CTRL, &jkdet);
 	active_high = jkdet & NAU8821_JACK_POLARITY;
-	regmap_read(regmap, NAU8821_REG_GENERAL_STATUS, &status);
 	is_high = status & NAU8821_GPIO2_IN;
 	/* return jack connection status according to jack insertion logic
 	 * active high or active low.
@@ -869,6 +1411,14 @@ static bool nau8821_is_jack_inserted(struct regmap *regmap)
 	return active_high == is_high;
 }
 
+static bool nau8821_is_jack_inserted(struct regmap *regmap)
+{
+	int status;
+
+	regmap_read(regmap, NAU8821_REG_GENERAL_STATUS, &status);
+	return nau8821_jack_status_inserted(regmap, status);
+}
+
 static void nau8821_restart_jack_detection(struct regmap *regmap)
 {
 	/* this will restart the entire jack detection process including MIC/GND
@@ -881,14 +1431,59 @@ static void nau8821_restart_jack_detection(struct regmap *regmap)
 		NAU8821_JACK_DET_RESTART, 0);
 }
 
-static void nau8821_int_status_clear_all(struct regmap *regmap)
+/**
+ * nau8821_int_status_clear_all - acknowledge all pending interruptions
+ * @nau8821: driver private data
+ *
+ * The active bits are written to INT_CLR_KEY_STATUS in a single write.
+ * The first bulk acknowledgement is verified by reading IRQ_STATUS back;
+ * if the codec only honours one bit per write, the remaining bits are
+ * cleared one by one and the driver stays on that per-bit path, which
+ * clears the status from the rightmost bit as the codec expects.
+ */
+static void nau8821_int_status_clear_all(struct nau8821 *nau8821)
 {
-	int active_irq, clear_irq, i;
+	struct regmap *regmap = nau8821->regmap;
+	unsigned int active_irq, remain_irq, clear_irq;
+	enum nau8821_irq_clear_mode mode;
+	int i;
+
+	if (regmap_read(regmap, NAU8821_REG_IRQ_STATUS, &active_irq) ||
+		!active_irq)
+		return;
+
+	mode = READ_ONCE(nau8821->irq_clear_mode);
+	if (mode != NAU8821_IRQ_CLEAR_PER_BIT) {
+		regmap_write(regmap, NAU8821_REG_INT_CLR_KEY_STATUS, active_irq);
+		if (mode == NAU8821_IRQ_CLEAR_BULK)
+			return;
+
+		/* Only the bits just cleared tell whether the write worked */
+		if (regmap_read(regmap, NAU8821_REG_IRQ_STATUS, &remain_irq))
+			return;
+		remain_irq &= active_irq;
+		if (!remain_irq) {
+			WRITE_ONCE(nau8821->irq_clear_mode,
+				NAU8821_IRQ_CLEAR_BULK);
+			return;
+		}
+		/* The event may have latched again after the write; retry once
+		 * and keep probing if that clears it.
+		 */
+		regmap_write(regmap, NAU8821_REG_INT_CLR_KEY_STATUS, remain_irq);
+		if (regmap_read(regmap, NAU8821_REG_IRQ_STATUS, &clear_irq))
+			return;
+		if (!(clear_irq & remain_irq))
+			return;
+		dev_info(nau8821->dev, "Bulk IRQ acknowledge not supported (%x left), clearing per bit\n",
+			clear_irq & remain_irq);
+		WRITE_ONCE(nau8821->irq_clear_mode, NAU8821_IRQ_CLEAR_PER_BIT);
+		active_irq = clear_irq & remain_irq;
+	}
 
 	/* Reset the intrruption status from rightmost bit if the corres-
 	 * ponding irq event occurs.
 	 */
-	regmap_read(regmap, NAU8821_REG_IRQ_STATUS, &active_irq);
 	for (i = 0; i < NAU8821_REG_DATA_LEN; i++) {
 		clear_irq = (0x1 << i);
 		if (active_irq & clear_irq)
@@ -897,201 +1492,1895 @@ static void nau8821_int_status_clear_all(struct regmap *regmap)
 	}
 }
 
-static void nau8821_eject_jack(struct nau8821 *nau8821)
-{
-	struct snd_soc_dapm_context *dapm = nau8821->dapm;
-	struct regmap *regmap = nau8821->regmap;
+/* Actions of a jack state machine transition besides its register delta,
+ * carried out in this order around the delta.
+ */
+#define NAU8821_JACK_F_CLEAR_IRQ	(0x1 << 0)	/* acknowledge all status */
+#define NAU8821_JACK_F_CLK_INTERNAL	(0x1 << 1)	/* internal VCO clock */
+#define NAU8821_JACK_F_FSCLK		(0x1 << 2)	/* one FSCLK cycle */
+#define NAU8821_JACK_F_RESTART		(0x1 << 3)	/* restart detection */
+#define NAU8821_JACK_F_CLK_DIS		(0x1 << 4)	/* external clock */
+#define NAU8821_JACK_F_MICBIAS		(0x1 << 5)	/* force MICBIAS pin */
+#define NAU8821_JACK_F_KEEP_STATE	(0x1 << 6)	/* report only */
+#define NAU8821_JACK_F_ARM		(0x1 << 7)	/* armed if clock runs */
 
-	/* Reset semaphore */
-	nau8821_sema_reset(nau8821);
+#define NAU8821_BUTTON SND_JACK_BTN_0
 
-	/* Detach 2kOhm Resistors from MICBIAS to MICGND */
-	regmap_update_bits(regmap, NAU8821_REG_MIC_BIAS,
-		NAU8821_MICBIAS_JKR2, 0);
-	/* HPL/HPR short to ground */
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
-		NAU8821_SPKR_DWN1R | NAU8821_SPKR_DWN1L, 0);
-	//snd_soc_dapm_disable_pin(dapm, "MICBIAS");
-	snd_soc_dapm_sync(dapm);
+/**
+ * struct nau8821_jack_trans - jack state machine transition
+ * @next: state after the transition
+ * @op: operation accounted in the I2C statistics, or NAU8821_OP_NUM
+ * @flags: NAU8821_JACK_F_* actions
+ * @report: jack status reported, together with @report_mask
+ * @report_mask: jack status bits reported, none if zero
+ * @delta: register fields the transition changes, written in one
+ * transaction so fields already in place cost no bus traffic
+ * @delta_num: number of entries in @delta
+ */
+struct nau8821_jack_trans {
+	enum nau8821_jack_state next;
+	enum nau8821_op op;
+	unsigned int flags;
+	int report;
+	int report_mask;
+	const struct nau8821_txn_entry *delta;
+	unsigned int delta_num;
+};
 
-	/* Clear all interruption status */
-	nau8821_int_status_clear_all(regmap);
+#define NAU8821_JACK_DELTA(d) .delta = d, .delta_num = ARRAY_SIZE(d)
 
-	/* Enable the insertion interruption, disable the ejection inter-
-	 * ruption, and then bypass de-bounce circuit.
-	 */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_DIS_CTRL,
+/* Manual mode waiting for an insertion with the de-bounce circuit bypassed */
+static const struct nau8821_txn_entry nau8821_jack_eject_delta[] = {
+	/* Detach 2kOhm Resistors from MICBIAS to MICGND */
+	{ NAU8821_REG_MIC_BIAS, NAU8821_MICBIAS_JKR2, 0 },
+	/* HPL/HPR short to ground, bypass de-bounce circuit */
+	{ NAU8821_REG_JACK_DET_CTRL, NAU8821_SPKR_DWN1R | NAU8821_SPKR_DWN1L |
+		NAU8821_JACK_DET_DB_BYPASS, NAU8821_JACK_DET_DB_BYPASS },
+	/* Enable the insertion interruption, disable the ejection one */
+	{ NAU8821_REG_INTERRUPT_DIS_CTRL,
 		NAU8821_IRQ_EJECT_DIS | NAU8821_IRQ_INSERT_DIS,
-		NAU8821_IRQ_EJECT_DIS);
+		NAU8821_IRQ_EJECT_DIS },
 	/* Mask unneeded IRQs: 1 - disable, 0 - enable */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_MASK,
+	{ NAU8821_REG_INTERRUPT_MASK,
 		NAU8821_IRQ_EJECT_EN | NAU8821_IRQ_INSERT_EN,
-		NAU8821_IRQ_EJECT_EN);
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
-		NAU8821_JACK_DET_DB_BYPASS, NAU8821_JACK_DET_DB_BYPASS);
-
-	/* Disable ADC needed for interruptions at audo mode */
-	regmap_update_bits(regmap, NAU8821_REG_ENA_CTRL,
-		NAU8821_EN_ADCR | NAU8821_EN_ADCL, 0);
-
-	/* Close clock for jack type detection at manual mode */
-	nau8821_configure_sysclk(nau8821, NAU8821_CLK_DIS, 0);
-}
-
-/* Enable audo mode interruptions with internal clock. */
-static void nau8821_setup_auto_irq(struct nau8821 *nau8821)
-{
-	struct regmap *regmap = nau8821->regmap;
+		NAU8821_IRQ_EJECT_EN },
+	/* Disable ADC needed for interruptions at auto mode */
+	{ NAU8821_REG_ENA_CTRL, NAU8821_EN_ADCR | NAU8821_EN_ADCL, 0 },
+};
 
-	/* Enable internal VCO needed for interruptions */
-	nau8821_configure_sysclk(nau8821, NAU8821_CLK_INTERNAL, 0);
+/* Auto mode interruptions with a jack: type, buttons and ejection */
+#define NAU8821_JACK_AUTO_IRQS \
+	{ NAU8821_REG_INTERRUPT_MASK, NAU8821_IRQ_INSERT_EN | \
+		NAU8821_IRQ_EJECT_EN | NAU8821_IRQ_MIC_DET_EN | \
+		NAU8821_IRQ_KEY_RELEASE_EN | NAU8821_IRQ_KEY_PRESS_EN, \
+		NAU8821_IRQ_INSERT_EN }, \
+	{ NAU8821_REG_INTERRUPT_DIS_CTRL, NAU8821_IRQ_INSERT_DIS | \
+		NAU8821_IRQ_EJECT_DIS | NAU8821_IRQ_MIC_DIS | \
+		NAU8821_IRQ_KEY_RELEASE_DIS | NAU8821_IRQ_KEY_PRESS_DIS, \
+		NAU8821_IRQ_INSERT_DIS }
+
+/* Auto mode detecting the jack type, buttons and ejection */
+static const struct nau8821_txn_entry nau8821_jack_auto_delta[] = {
 	/* Enable ADC needed for interruptions */
-	regmap_update_bits(regmap, NAU8821_REG_ENA_CTRL,
-		NAU8821_EN_ADCR | NAU8821_EN_ADCL,
-		NAU8821_EN_ADCR | NAU8821_EN_ADCL);
-	/* Chip needs one FSCLK cycle in order to generate interruptions,
-	 * as we cannot guarantee one will be provided by the system. Turning
-	 * master mode on then off enables us to generate that FSCLK cycle
-	 * with a minimum of contention on the clock bus.
+	{ NAU8821_REG_ENA_CTRL, NAU8821_EN_ADCR | NAU8821_EN_ADCL,
+		NAU8821_EN_ADCR | NAU8821_EN_ADCL },
+	/* Not bypass de-bounce circuit */
+	{ NAU8821_REG_JACK_DET_CTRL, NAU8821_JACK_DET_DB_BYPASS, 0 },
+	/* Turn off the insertion interruption of manual mode, unmask and
+	 * enable the detection interruptions.
 	 */
-	regmap_update_bits(regmap, NAU8821_REG_I2S_PCM_CTRL2,
-		NAU8821_I2S_MS_MASK, NAU8821_I2S_MS_MASTER);
-	regmap_update_bits(regmap, NAU8821_REG_I2S_PCM_CTRL2,
-		NAU8821_I2S_MS_MASK, NAU8821_I2S_MS_SLAVE);
+	NAU8821_JACK_AUTO_IRQS,
+};
 
-	/* Not bypass de-bounce circuit */
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
-		NAU8821_JACK_DET_DB_BYPASS, 0);
-
-	/* Unmask detection interruptions */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_MASK,
+/* Auto mode without a jack, the insertion is reported once the type is
+ * detected, so the interruption of manual mode and its round trip to
+ * auto mode are not needed.
+ */
+static const struct nau8821_txn_entry nau8821_jack_armed_delta[] = {
+	/* Detach 2kOhm Resistors from MICBIAS to MICGND */
+	{ NAU8821_REG_MIC_BIAS, NAU8821_MICBIAS_JKR2, 0 },
+	/* HPL/HPR short to ground, not bypass de-bounce circuit */
+	{ NAU8821_REG_JACK_DET_CTRL, NAU8821_SPKR_DWN1R | NAU8821_SPKR_DWN1L |
+		NAU8821_JACK_DET_DB_BYPASS, 0 },
+	/* Only the insertion and microphone interruptions */
+	{ NAU8821_REG_INTERRUPT_MASK, NAU8821_IRQ_INSERT_EN |
 		NAU8821_IRQ_EJECT_EN | NAU8821_IRQ_MIC_DET_EN |
-		NAU8821_IRQ_KEY_RELEASE_EN | NAU8821_IRQ_KEY_PRESS_EN, 0);
-	/* Enable detection interruptions */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_DIS_CTRL,
+		NAU8821_IRQ_KEY_RELEASE_EN | NAU8821_IRQ_KEY_PRESS_EN,
+		NAU8821_IRQ_EJECT_EN | NAU8821_IRQ_KEY_RELEASE_EN |
+		NAU8821_IRQ_KEY_PRESS_EN },
+	{ NAU8821_REG_INTERRUPT_DIS_CTRL, NAU8821_IRQ_INSERT_DIS |
 		NAU8821_IRQ_EJECT_DIS | NAU8821_IRQ_MIC_DIS |
-		NAU8821_IRQ_KEY_RELEASE_DIS | NAU8821_IRQ_KEY_PRESS_DIS, 0);
+		NAU8821_IRQ_KEY_RELEASE_DIS | NAU8821_IRQ_KEY_PRESS_DIS,
+		NAU8821_IRQ_EJECT_DIS | NAU8821_IRQ_KEY_RELEASE_DIS |
+		NAU8821_IRQ_KEY_PRESS_DIS },
+	/* Enable ADC needed for interruptions */
+	{ NAU8821_REG_ENA_CTRL, NAU8821_EN_ADCR | NAU8821_EN_ADCL,
+		NAU8821_EN_ADCR | NAU8821_EN_ADCL },
+};
+
+static const struct nau8821_txn_entry nau8821_jack_armed_hp_delta[] = {
+	NAU8821_JACK_AUTO_IRQS,
+};
+
+static const struct nau8821_txn_entry nau8821_jack_armed_hs_delta[] = {
+	NAU8821_JACK_AUTO_IRQS,
+	/* Attach 2kOhm Resistor from MICBIAS to MICGND1 */
+	{ NAU8821_REG_MIC_BIAS, NAU8821_MICBIAS_JKR2, NAU8821_MICBIAS_JKR2 },
+};
+
+static const struct nau8821_txn_entry nau8821_jack_headset_delta[] = {
+	/* Attach 2kOhm Resistor from MICBIAS to MICGND1 */
+	{ NAU8821_REG_MIC_BIAS, NAU8821_MICBIAS_JKR2, NAU8821_MICBIAS_JKR2 },
+};
+
+static const struct nau8821_jack_trans nau8821_jack_to_ejected = {
+	.next = NAU8821_JACK_EJECTED,
+	.op = NAU8821_OP_EJECT_JACK,
+	.flags = NAU8821_JACK_F_CLEAR_IRQ | NAU8821_JACK_F_CLK_DIS |
+		NAU8821_JACK_F_ARM,
+	.report_mask = SND_JACK_HEADSET,
+	NAU8821_JACK_DELTA(nau8821_jack_eject_delta),
+};
+
+/* Replaces nau8821_jack_to_ejected while the external clock runs, which
+ * stays the system clock.
+ */
+static const struct nau8821_jack_trans nau8821_jack_to_armed = {
+	.next = NAU8821_JACK_ARMED,
+	.op = NAU8821_OP_EJECT_JACK,
+	.flags = NAU8821_JACK_F_CLEAR_IRQ,
+	.report_mask = SND_JACK_HEADSET,
+	NAU8821_JACK_DELTA(nau8821_jack_armed_delta),
+};
+
+static const struct nau8821_jack_trans nau8821_jack_to_detecting = {
+	.next = NAU8821_JACK_DETECTING,
+	.op = NAU8821_OP_AUTO_IRQ,
+	.flags = NAU8821_JACK_F_CLK_INTERNAL | NAU8821_JACK_F_FSCLK |
+		NAU8821_JACK_F_RESTART,
+	NAU8821_JACK_DELTA(nau8821_jack_auto_delta),
+};
+
+static const struct nau8821_jack_trans nau8821_jack_to_headphone = {
+	.next = NAU8821_JACK_HEADPHONE,
+	.op = NAU8821_OP_NUM,
+	.report = SND_JACK_HEADPHONE,
+	.report_mask = SND_JACK_HEADSET,
+};
+
+static const struct nau8821_jack_trans nau8821_jack_to_headset = {
+	.next = NAU8821_JACK_HEADSET,
+	.op = NAU8821_OP_NUM,
+	.flags = NAU8821_JACK_F_MICBIAS,
+	.report = SND_JACK_HEADSET,
+	.report_mask = SND_JACK_HEADSET,
+	NAU8821_JACK_DELTA(nau8821_jack_headset_delta),
+};
+
+static const struct nau8821_jack_trans nau8821_jack_armed_to_headphone = {
+	.next = NAU8821_JACK_HEADPHONE,
+	.op = NAU8821_OP_NUM,
+	.report = SND_JACK_HEADPHONE,
+	.report_mask = SND_JACK_HEADSET,
+	NAU8821_JACK_DELTA(nau8821_jack_armed_hp_delta),
+};
+
+static const struct nau8821_jack_trans nau8821_jack_armed_to_headset = {
+	.next = NAU8821_JACK_HEADSET,
+	.op = NAU8821_OP_NUM,
+	.flags = NAU8821_JACK_F_MICBIAS,
+	.report = SND_JACK_HEADSET,
+	.report_mask = SND_JACK_HEADSET,
+	NAU8821_JACK_DELTA(nau8821_jack_armed_hs_delta),
+};
+
+static const struct nau8821_jack_trans nau8821_jack_key_press = {
+	.op = NAU8821_OP_NUM,
+	.flags = NAU8821_JACK_F_KEEP_STATE,
+	.report = NAU8821_BUTTON,
+	.report_mask = NAU8821_BUTTON,
+};
+
+static const struct nau8821_jack_trans nau8821_jack_key_release = {
+	.op = NAU8821_OP_NUM,
+	.flags = NAU8821_JACK_F_KEEP_STATE,
+	.report_mask = NAU8821_BUTTON,
+};
+
+/* Transitions by state and event. An event without a transition in the
+ * current state, a repeated or spurious interrupt, is acknowledged and
+ * otherwise ignored. The jack type stays until ejection, except that a
+ * headphone found to have a microphone after all becomes a headset.
+ */
+static const struct nau8821_jack_trans *
+nau8821_jack_fsm[NAU8821_JACK_STATE_NUM][NAU8821_JACK_EV_NUM] = {
+	[NAU8821_JACK_UNKNOWN] = {
+		[NAU8821_JACK_EV_EJECT] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_INSERT] = &nau8821_jack_to_detecting,
+		[NAU8821_JACK_EV_NO_JACK] = &nau8821_jack_to_ejected,
+	},
+	[NAU8821_JACK_EJECTED] = {
+		[NAU8821_JACK_EV_INSERT] = &nau8821_jack_to_detecting,
+	},
+	[NAU8821_JACK_ARMED] = {
+		[NAU8821_JACK_EV_NO_JACK] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_HEADPHONE] = &nau8821_jack_armed_to_headphone,
+		[NAU8821_JACK_EV_HEADSET] = &nau8821_jack_armed_to_headset,
+	},
+	[NAU8821_JACK_DETECTING] = {
+		[NAU8821_JACK_EV_EJECT] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_NO_JACK] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_HEADPHONE] = &nau8821_jack_to_headphone,
+		[NAU8821_JACK_EV_HEADSET] = &nau8821_jack_to_headset,
+	},
+	[NAU8821_JACK_HEADPHONE] = {
+		[NAU8821_JACK_EV_EJECT] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_NO_JACK] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_HEADSET] = &nau8821_jack_to_headset,
+		[NAU8821_JACK_EV_KEY_PRESS] = &nau8821_jack_key_press,
+		[NAU8821_JACK_EV_KEY_RELEASE] = &nau8821_jack_key_release,
+	},
+	[NAU8821_JACK_HEADSET] = {
+		[NAU8821_JACK_EV_EJECT] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_NO_JACK] = &nau8821_jack_to_ejected,
+		[NAU8821_JACK_EV_KEY_PRESS] = &nau8821_jack_key_press,
+		[NAU8821_JACK_EV_KEY_RELEASE] = &nau8821_jack_key_release,
+	},
+};
+
+/**
+ * nau8821_jack_clk_running - whether the external clock keeps auto mode on
+ * @nau8821: driver private data
+ *
+ * Auto mode needs a clock. Without a jack the internal VCO is off for
+ * power saving, but while a stream runs on an external clock that clock
+ * can keep auto mode armed for the next insertion.
+ *
+ * Called with clk_lock held, which covers both the clock selection and the
+ * bias level copy updated by nau8821_set_bias_level().
+ */
+static bool nau8821_jack_clk_running(struct nau8821 *nau8821)
+{
+	switch (nau8821->clk_id) {
+	case NAU8821_CLK_MCLK:
+	case NAU8821_CLK_FLL_MCLK:
+	case NAU8821_CLK_FLL_BLK:
+	case NAU8821_CLK_FLL_FS:
+		return nau8821->bias_on;
+	default:
+		return false;
+	}
+}
+
+/**
+ * nau8821_jack_apply_locked - carry out the register part of a transition
+ * @nau8821: driver private data
+ * @trans: the transition
+ *
+ * The register delta goes out as one transaction, around it only the
+ * steps that need their own order: the status acknowledgement, the clock
+ * switches, the FSCLK cycle and the detection restart.
+ *
+ * Called with clk_lock held, so that the armed decision and the clock
+ * switches do not interleave with hw_params or set_sysclk.
+ */
+static void nau8821_jack_apply_locked(struct nau8821 *nau8821,
+	const struct nau8821_jack_trans *trans)
+{
+	struct regmap *regmap = nau8821->regmap;
+	struct nau8821_txn txn;
+	struct nau8821_op_ctx op;
+	unsigned int i;
+
+	if ((trans->flags & NAU8821_JACK_F_ARM) &&
+		nau8821_jack_clk_running(nau8821))
+		trans = &nau8821_jack_to_armed;
+	if (trans->op != NAU8821_OP_NUM)
+		nau8821_op_begin(nau8821, &op, trans->op);
+
+	if (trans->flags & NAU8821_JACK_F_CLEAR_IRQ)
+		/* Clear all interruption status */
+		nau8821_int_status_clear_all(nau8821);
+	if (trans->next == NAU8821_JACK_EJECTED)
+		/* The ejected state disables the ADCs */
+		nau8821_adc_cancel(nau8821);
+	if (trans->flags & NAU8821_JACK_F_CLK_INTERNAL)
+		/* Enable internal VCO needed for interruptions */
+		nau8821_configure_sysclk_locked(nau8821,
+			NAU8821_CLK_INTERNAL, 0);
+
+	if (trans->delta_num) {
+		nau8821_txn_init(&txn, regmap);
+		for (i = 0; i < trans->delta_num; i++)
+			nau8821_txn_update(&txn, trans->delta[i].reg,
+				trans->delta[i].mask, trans->delta[i].val);
+		if (nau8821_txn_commit(&txn))
+			dev_err(nau8821->dev, "Failed to update jack detection\n");
+	}
+
+	if (trans->flags & NAU8821_JACK_F_FSCLK) {
+		/* Chip needs one FSCLK cycle in order to generate interruptions,
+		 * as we cannot guarantee one will be provided by the system.
+		 * Turning master mode on then off enables us to generate that
+		 * FSCLK cycle with a minimum of contention on the clock bus.
+		 */
+		regmap_update_bits(regmap, NAU8821_REG_I2S_PCM_CTRL2,
+			NAU8821_I2S_MS_MASK, NAU8821_I2S_MS_MASTER);
+		regmap_update_bits(regmap, NAU8821_REG_I2S_PCM_CTRL2,
+			NAU8821_I2S_MS_MASK, NAU8821_I2S_MS_SLAVE);
+	}
+	if (trans->flags & NAU8821_JACK_F_RESTART)
+		/* Restart the jack detection process at auto mode */
+		nau8821_restart_jack_detection(regmap);
+	if (trans->flags & NAU8821_JACK_F_CLK_DIS)
+		/* Close clock for jack type detection at manual mode */
+		nau8821_configure_sysclk_locked(nau8821, NAU8821_CLK_DIS, 0);
+
+	if (!(trans->flags & NAU8821_JACK_F_KEEP_STATE)) {
+		nau8821->jack_state = trans->next;
+		/* Playback configuration waits while the type is detected */
+		if (trans->next == NAU8821_JACK_DETECTING)
+			nau8821_jd_start(nau8821);
+		else if (trans->next == NAU8821_JACK_EJECTED ||
+			trans->next == NAU8821_JACK_ARMED)
+			nau8821_jd_finish(nau8821, NAU8821_JD_IDLE);
+		else
+			nau8821_jd_finish(nau8821, NAU8821_JD_DONE);
+	}
+
+	if (trans->op != NAU8821_OP_NUM)
+		nau8821_op_end(nau8821, &op);
+}
+
+/**
+ * nau8821_jack_apply - carry out a jack state machine transition
+ * @nau8821: driver private data
+ * @trans: the transition
+ *
+ * DAPM is synced once, after all register changes and only if a pin
+ * changed. That is done after clk_lock is dropped, as the bias level
+ * callback takes it. The jack detection in flight is what holds off
+ * nau8821_clk_lock(), so the lock is taken without waiting for it.
+ */
+static void nau8821_jack_apply(struct nau8821 *nau8821,
+	const struct nau8821_jack_trans *trans)
+{
+	mutex_lock(&nau8821->clk_lock);
+	nau8821_jack_apply_locked(nau8821, trans);
+	mutex_unlock(&nau8821->clk_lock);
+
+	if (trans->flags & NAU8821_JACK_F_MICBIAS) {
+		snd_soc_dapm_force_enable_pin(nau8821->dapm, "MICBIAS");
+		snd_soc_dapm_sync(nau8821->dapm);
+	}
+}
+
+/**
+ * nau8821_jack_mark - time stamp a stage boundary of the detection
+ * @nau8821: driver private data
+ * @mark: the boundary
+ * @at: snapshot taken earlier, such as at the interruption entry, or NULL
+ * for now
+ */
+static void nau8821_jack_mark(struct nau8821 *nau8821,
+	enum nau8821_jack_mark mark, const struct nau8821_op_ctx *at)
+{
+	if (at)
+		nau8821->jack_mark[mark] = *at;
+	else
+		nau8821_op_snapshot(nau8821, &nau8821->jack_mark[mark],
+			NAU8821_OP_INTERRUPT);
+	nau8821->jack_marks |= 0x1 << mark;
+}
+
+/* Once the jack type is reported, account the stages the detection went
+ * through by outcome, and its total by path.
+ */
+static void nau8821_jack_det_account(struct nau8821 *nau8821, int prev,
+	int next)
+{
+	struct nau8821_io_stats *stats = &nau8821->stats;
+	struct nau8821_op_ctx *mark = nau8821->jack_mark;
+	unsigned int i, out, need;
+
+	need = (0x1 << NAU8821_JACK_MARK_EDGE) |
+		(0x1 << NAU8821_JACK_MARK_MIC_IRQ);
+	if ((next == NAU8821_JACK_HEADPHONE || next == NAU8821_JACK_HEADSET) &&
+		(prev == NAU8821_JACK_DETECTING || prev == NAU8821_JACK_ARMED) &&
+		(nau8821->jack_marks & need) == need) {
+		nau8821_jack_mark(nau8821, NAU8821_JACK_MARK_REPORT, NULL);
+		out = next == NAU8821_JACK_HEADSET ?
+			NAU8821_JACK_OUT_HEADSET : NAU8821_JACK_OUT_HEADPHONE;
+		for (i = 0; i < NAU8821_JACK_STAGE_NUM; i++) {
+			need = (0x1 << nau8821_jack_stages[i].from) |
+				(0x1 << nau8821_jack_stages[i].to);
+			if ((nau8821->jack_marks & need) == need)
+				nau8821_op_account_span(nau8821,
+					&mark[nau8821_jack_stages[i].from],
+					&mark[nau8821_jack_stages[i].to],
+					&stats->jack_stage[out][i]);
+		}
+		nau8821_op_account_span(nau8821,
+			&mark[NAU8821_JACK_MARK_EDGE],
+			&mark[NAU8821_JACK_MARK_REPORT],
+			&stats->jack_det[prev == NAU8821_JACK_ARMED ?
+			NAU8821_JACK_DET_ONE_PASS : NAU8821_JACK_DET_TWO_PASS]);
+	}
+	if (next != NAU8821_JACK_DETECTING)
+		nau8821->jack_marks = 0;
+}
+
+/* Mask the interruption and wait for a running handler, whether the
+ * interruption comes from the codec or from the register model.
+ */
+static void nau8821_irq_disable(struct nau8821 *nau8821)
+{
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+	if (nau8821->model) {
+		mutex_lock(&nau8821->model->irq_lock);
+		nau8821->model->irq_disabled++;
+		mutex_unlock(&nau8821->model->irq_lock);
+		return;
+	}
+#endif
+	disable_irq(nau8821->irq);
+}
+
+static void nau8821_irq_enable(struct nau8821 *nau8821)
+{
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+	if (nau8821->model) {
+		mutex_lock(&nau8821->model->irq_lock);
+		nau8821->model->irq_disabled--;
+		mutex_unlock(&nau8821->model->irq_lock);
+		/* Like a level interruption, raise what came in meanwhile */
+		schedule_work(&nau8821->model->irq_work);
+		return;
+	}
+#endif
+	enable_irq(nau8821->irq);
+}
+
+/* The stream whose clock kept auto mode armed has stopped; fall back to
+ * manual mode, which needs no clock, and pick up a jack plugged in since.
+ */
+static void nau8821_jack_disarm_work(struct work_struct *work)
+{
+	struct nau8821 *nau8821 =
+		container_of(work, struct nau8821, jack_disarm_work);
+
+	nau8821_irq_disable(nau8821);
+	/* A stream may have started again since the work was queued */
+	mutex_lock(&nau8821->clk_lock);
+	if (nau8821->jack_state == NAU8821_JACK_ARMED &&
+		!nau8821_jack_clk_running(nau8821)) {
+		nau8821_jack_apply_locked(nau8821, &nau8821_jack_to_ejected);
+		if (nau8821_is_jack_inserted(nau8821->regmap)) {
+			nau8821->jack_marks = 0;
+			nau8821_jack_mark(nau8821, NAU8821_JACK_MARK_EDGE, NULL);
+			nau8821_jack_mark(nau8821, NAU8821_JACK_MARK_MANUAL,
+				NULL);
+			nau8821_jack_apply_locked(nau8821,
+				&nau8821_jack_to_detecting);
+			nau8821_jack_mark(nau8821, NAU8821_JACK_MARK_AUTO, NULL);
+		}
+	}
+	mutex_unlock(&nau8821->clk_lock);
+	nau8821_irq_enable(nau8821);
+}
+
+/* Status an interruption is decoded from, in the order it is read */
+enum {
+	NAU8821_STATUS_IRQ,
+	NAU8821_STATUS_GENERAL,
+	NAU8821_STATUS_DEVICE_ID,
+	NAU8821_STATUS_NUM,
+};
+
+static const unsigned int nau8821_status_regs[NAU8821_STATUS_NUM] = {
+	[NAU8821_STATUS_IRQ] = NAU8821_REG_IRQ_STATUS,
+	[NAU8821_STATUS_GENERAL] = NAU8821_REG_GENERAL_STATUS,
+	[NAU8821_STATUS_DEVICE_ID] = NAU8821_REG_I2C_DEVICE_ID,
+};
+
+/* Whether the jack type can be read yet, once auto mode is on */
+static bool nau8821_jack_manual(struct nau8821 *nau8821)
+{
+	return nau8821->jack_state == NAU8821_JACK_UNKNOWN ||
+		nau8821->jack_state == NAU8821_JACK_EJECTED;
+}
+
+/**
+ * nau8821_jack_decode - decode the jack event of an interruption
+ * @nau8821: driver private data
+ * @status: NAU8821_STATUS_* registers, the jack type only in auto mode
+ * @clear_irq: returns the status bits to acknowledge
+ *
+ * Returns the NAU8821_JACK_EV_* event, or -ENOENT if the status holds
+ * none.
+ */
+static int nau8821_jack_decode(struct nau8821 *nau8821,
+	const unsigned int *status, unsigned int *clear_irq)
+{
+	unsigned int active_irq = status[NAU8821_STATUS_IRQ];
+
+	*clear_irq = active_irq;
+	if ((active_irq & NAU8821_JACK_EJECT_IRQ_MASK) ==
+		NAU8821_JACK_EJECT_DETECTED) {
+		*clear_irq = NAU8821_JACK_EJECT_IRQ_MASK;
+		return NAU8821_JACK_EV_EJECT;
+	} else if (active_irq & NAU8821_KEY_SHORT_PRESS_IRQ) {
+		*clear_irq = NAU8821_KEY_SHORT_PRESS_IRQ;
+		return NAU8821_JACK_EV_KEY_PRESS;
+	} else if (active_irq & NAU8821_KEY_RELEASE_IRQ) {
+		*clear_irq = NAU8821_KEY_RELEASE_IRQ;
+		return NAU8821_JACK_EV_KEY_RELEASE;
+	} else if ((active_irq & NAU8821_JACK_INSERT_IRQ_MASK) !=
+		NAU8821_JACK_INSERT_DETECTED) {
+		return -ENOENT;
+	}
+
+	/* One more step to check GPIO status directly. Thus, the driver can
+	 * confirm the real insertion interruption because the intrruption
+	 * at manual mode has bypassed debounce circuit which can get rid of
+	 * unstable status.
+	 */
+	if (!nau8821_jack_status_inserted(nau8821->regmap,
+		status[NAU8821_STATUS_GENERAL])) {
+		dev_warn(nau8821->dev, "Headset completion IRQ fired but no headset connected\n");
+		return NAU8821_JACK_EV_NO_JACK;
+	}
+	if (nau8821_jack_manual(nau8821))
+		return NAU8821_JACK_EV_INSERT;
+	if (status[NAU8821_STATUS_DEVICE_ID] & NAU8821_MICDET) {
+		dev_dbg(nau8821->dev, "OMTP (micgnd1) mic connected\n");
+		return NAU8821_JACK_EV_HEADSET;
+	}
+
+	return NAU8821_JACK_EV_HEADPHONE;
+}
+
+static irqreturn_t nau8821_interrupt(int irq, void *data)
+{
+	struct nau8821 *nau8821 = (struct nau8821 *)data;
+	struct regmap *regmap = nau8821->regmap;
+	const struct nau8821_jack_trans *trans = NULL;
+	struct nau8821_op_ctx op;
+	unsigned int status[NAU8821_STATUS_NUM], active_irq, clear_irq;
+	int event, prev = nau8821->jack_state;
+
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_INTERRUPT);
+	/* The status and the jack status in one combined transfer, the jack
+	 * type only once auto mode is on
+	 */
+	if (nau8821_read_status(nau8821, nau8821_status_regs, status,
+		nau8821_jack_manual(nau8821) ? NAU8821_STATUS_DEVICE_ID :
+		NAU8821_STATUS_NUM)) {
+		dev_err(nau8821->dev, "failed to read irq status\n");
+		nau8821_op_end(nau8821, &op);
+		return IRQ_NONE;
+	}
+	active_irq = status[NAU8821_STATUS_IRQ];
+	dev_dbg(nau8821->dev, "IRQ 0x%x\n", active_irq);
+
+	event = nau8821_jack_decode(nau8821, status, &clear_irq);
+	if (event >= 0) {
+		trans = nau8821_jack_fsm[nau8821->jack_state][event];
+		if (event == NAU8821_JACK_EV_NO_JACK) {
+			spin_lock(&nau8821->stats_lock);
+			nau8821->stats.jack_spurious++;
+			spin_unlock(&nau8821->stats_lock);
+		}
+		if (trans) {
+			if (trans->next == NAU8821_JACK_DETECTING) {
+				nau8821->jack_marks = 0;
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_EDGE, &op);
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_MANUAL, NULL);
+			} else if (prev == NAU8821_JACK_ARMED) {
+				/* One pass, the edge carries the type */
+				nau8821->jack_marks = 0;
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_EDGE, &op);
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_MIC_IRQ, &op);
+			} else if (prev == NAU8821_JACK_DETECTING) {
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_MIC_IRQ, &op);
+			}
+			nau8821_jack_apply(nau8821, trans);
+			if (nau8821->jack_state == NAU8821_JACK_DETECTING)
+				nau8821_jack_mark(nau8821,
+					NAU8821_JACK_MARK_AUTO, NULL);
+		} else {
+			dev_dbg(nau8821->dev, "jack %s ignored when %s\n",
+				nau8821_jack_ev_names[event],
+				nau8821_jack_state_names[nau8821->jack_state]);
+		}
+	} else if (event != -ENOENT) {
+		dev_err(nau8821->dev, "failed to read jack status\n");
+	}
+
+	/* clears the rightmost interruption */
+	regmap_write(regmap, NAU8821_REG_INT_CLR_KEY_STATUS, clear_irq);
+
+	if (trans && trans->report_mask) {
+		snd_soc_jack_report(nau8821->jack, trans->report,
+			trans->report_mask);
+		if (!((nau8821->jack_report ^ trans->report) &
+			trans->report_mask))
+			nau8821->jack_dup_reports++;
+		if (trans->report & ~nau8821->jack_report &
+			SND_JACK_HEADPHONE)
+			nau8821->jack_insert_reports++;
+		nau8821->jack_report = (nau8821->jack_report &
+			~trans->report_mask) | (trans->report & trans->report_mask);
+		nau8821->jack_reports++;
+	}
+	if (trans && !(trans->flags & NAU8821_JACK_F_KEEP_STATE))
+		nau8821_jack_det_account(nau8821, prev, nau8821->jack_state);
+	trace_nau8821_irq(nau8821->dev, active_irq, clear_irq, event, prev,
+		nau8821->jack_state, trans ? trans->report : 0,
+		trans ? trans->report_mask : 0);
+
+	if (event >= 0) {
+		nau8821_op_account(nau8821, &op,
+			&nau8821->stats.jack_ev[event]);
+		if (!trans) {
+			spin_lock(&nau8821->stats_lock);
+			nau8821->stats.jack_noops[event]++;
+			spin_unlock(&nau8821->stats_lock);
+		}
+	}
+	nau8821_op_end(nau8821, &op);
+
+	return IRQ_HANDLED;
+}
+
+static void nau8821_io_account(struct nau8821 *nau8821, unsigned int reg,
+	size_t val_len, size_t bytes, bool write)
+{
+	struct nau8821_io_stats *stats = &nau8821->stats;
+	unsigned int i, count = val_len / (NAU8821_REG_DATA_LEN / 8);
+
+	spin_lock(&nau8821->stats_lock);
+	if (write)
+		stats->writes++;
+	else
+		stats->reads++;
+	stats->bytes += bytes;
+	for (i = 0; i < count && reg + i <= NAU8821_REG_MAX; i++) {
+		if (write)
+			stats->reg_writes[reg + i]++;
+		else
+			stats->reg_reads[reg + i]++;
+	}
+	spin_unlock(&nau8821->stats_lock);
+}
+
+/**
+ * nau8821_io_log - log the register accesses of a transfer
+ * @nau8821: driver private data
+ * @reg: first register of the transfer
+ * @vals: big endian register values
+ * @val_len: length of @vals in bytes
+ * @write: whether the registers were written
+ *
+ * Writers claim a slot with one atomic increment and never wait. The
+ * sequence number is stored last, so a reader can tell a slot that is
+ * being rewritten.
+ */
+static void nau8821_io_log(struct nau8821 *nau8821, unsigned int reg,
+	const u8 *vals, size_t val_len, bool write)
+{
+	struct nau8821_io_log_entry *e;
+	u8 op = READ_ONCE(nau8821->io_op);
+	u64 ts = ktime_get_ns();
+	unsigned int seq;
+	size_t i;
+
+	if (!nau8821->io_log)
+		return;
+
+	for (i = 0; i + 1 < val_len; i += 2, reg++) {
+		seq = atomic_inc_return(&nau8821->io_log_seq);
+		e = &nau8821->io_log[(seq - 1) & (NAU8821_IO_LOG_SIZE - 1)];
+		WRITE_ONCE(e->seq, 0);
+		smp_wmb();
+		e->ts_ns = ts;
+		e->reg = reg;
+		e->val = (vals[i] << 8) | vals[i + 1];
+		e->write = write;
+		e->op = op;
+		smp_wmb();
+		WRITE_ONCE(e->seq, seq);
+	}
+}
+
+/* The regmap I2C bus with every transfer accounted in the statistics.
+ * Burst transfers stay one transfer, the registers they cover are each
+ * accounted once.
+ */
+static int nau8821_bus_write(void *context, const void *data, size_t count)
+{
+	struct nau8821 *nau8821 = context;
+	struct i2c_client *client = to_i2c_client(nau8821->dev);
+	const u8 *buf = data;
+	unsigned int reg = (buf[0] << 8) | buf[1];
+	size_t val_len = count - NAU8821_REG_ADDR_LEN / 8;
+	int ret;
+
+	ret = i2c_master_send(client, data, count);
+	nau8821_io_account(nau8821, reg, val_len, count, true);
+	if (ret == count) {
+		nau8821_io_log(nau8821, reg, buf + NAU8821_REG_ADDR_LEN / 8,
+			val_len, true);
+		return 0;
+	} else if (ret < 0)
+		return ret;
+	else
+		return -EIO;
+}
+
+static int nau8821_bus_read(void *context, const void *reg_buf,
+	size_t reg_size, void *val_buf, size_t val_size)
+{
+	struct nau8821 *nau8821 = context;
+	struct i2c_client *client = to_i2c_client(nau8821->dev);
+	const u8 *reg = reg_buf;
+	struct i2c_msg xfer[2];
+	int ret;
+
+	xfer[0].addr = client->addr;
+	xfer[0].len = reg_size;
+	xfer[0].buf = (u8 *)reg_buf;
+	xfer[0].flags = 0;
+
+	xfer[1].addr = client->addr;
+	xfer[1].len = val_size;
+	xfer[1].buf = val_buf;
+	xfer[1].flags = I2C_M_RD;
+
+	ret = i2c_transfer(client->adapter, xfer, ARRAY_SIZE(xfer));
+	nau8821_io_account(nau8821, (reg[0] << 8) | reg[1], val_size,
+		reg_size + val_size, false);
+	if (ret < 0)
+		return ret;
+	else if (ret != ARRAY_SIZE(xfer))
+		return -EIO;
+	nau8821_io_log(nau8821, (reg[0] << 8) | reg[1], val_buf, val_size,
+		false);
+
+	return 0;
+}
+
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+static void nau8821_model_reset(struct nau8821_model *model)
+{
+	unsigned int i;
+
+	memset(model->regs, 0, sizeof(model->regs));
+	model->detecting = false;
+	for (i = 0; i < ARRAY_SIZE(nau8821_reg_defaults); i++)
+		model->regs[nau8821_reg_defaults[i].reg] =
+			nau8821_reg_defaults[i].def;
+}
+
+/* Status bits raising the interruption, with the model lock held */
+static unsigned int nau8821_model_pending(struct nau8821_model *model)
+{
+	return model->regs[NAU8821_REG_IRQ_STATUS] & NAU8821_MODEL_IRQS &
+		~model->regs[NAU8821_REG_INTERRUPT_MASK];
+}
+
+/* Latch status bits, with the model lock held */
+static void nau8821_model_raise(struct nau8821_model *model,
+	unsigned int status)
+{
+	model->regs[NAU8821_REG_IRQ_STATUS] |= status;
+	if (nau8821_model_pending(model))
+		schedule_work(&model->irq_work);
+}
+
+/* With the jack plugged, auto mode reports its type along with the
+ * insertion; manual mode bypasses the debounce and reports the edge only.
+ */
+static void nau8821_model_detect(struct nau8821_model *model)
+{
+	if (!model->jack)
+		return;
+	if (model->regs[NAU8821_REG_JACK_DET_CTRL] &
+		NAU8821_JACK_DET_DB_BYPASS) {
+		nau8821_model_raise(model, NAU8821_JACK_INSERT_DETECTED);
+		return;
+	}
+	/* Auto mode reports once the debounce and type detection are over,
+	 * never from within the register write that started them.
+	 */
+	model->detecting = true;
+	schedule_delayed_work(&model->detect_work,
+		msecs_to_jiffies(NAU8821_MODEL_DETECT_MS));
+}
+
+static unsigned int nau8821_model_read(struct nau8821_model *model,
+	unsigned int reg)
+{
+	unsigned int val = reg <= NAU8821_REG_MAX ? model->regs[reg] : 0;
+	bool active_high;
+
+	switch (reg) {
+	case NAU8821_REG_GENERAL_STATUS:
+		active_high = model->regs[NAU8821_REG_JACK_DET_CTRL] &
+			NAU8821_JACK_POLARITY;
+		val &= ~NAU8821_GPIO2_IN;
+		if (model->jack == active_high)
+			val |= NAU8821_GPIO2_IN;
+		break;
+	case NAU8821_REG_I2C_DEVICE_ID:
+		val &= ~NAU8821_MICDET;
+		if (model->jack && model->mic)
+			val |= NAU8821_MICDET;
+		break;
+	case NAU8821_REG_INT_CLR_KEY_STATUS:
+		val = 0;
+		break;
+	}
+
+	return val;
+}
+
+static void nau8821_model_write(struct nau8821_model *model,
+	unsigned int reg, unsigned int val)
+{
+	unsigned int old;
+
+	if (reg > NAU8821_REG_MAX)
+		return;
+	old = model->regs[reg];
+	switch (reg) {
+	case NAU8821_REG_RESET:
+		nau8821_model_reset(model);
+		return;
+	case NAU8821_REG_INT_CLR_KEY_STATUS:
+		/* write 1 to clear */
+		model->regs[NAU8821_REG_IRQ_STATUS] &= ~val;
+		return;
+	case NAU8821_REG_IRQ_STATUS:
+		return;
+	}
+	model->regs[reg] = val;
+	if (reg == NAU8821_REG_JACK_DET_CTRL &&
+		(val & ~old & NAU8821_JACK_DET_RESTART))
+		nau8821_model_detect(model);
+	else if (reg == NAU8821_REG_INTERRUPT_MASK &&
+		nau8821_model_pending(model))
+		schedule_work(&model->irq_work);
+}
+
+/* The combined status read of nau8821_read_status() served by the model */
+static bool nau8821_model_read_status(struct nau8821 *nau8821,
+	const unsigned int *regs, u8 (*data)[2], int num)
+{
+	unsigned int val;
+	int i;
+
+	if (!nau8821->model)
+		return false;
+
+	spin_lock(&nau8821->model->lock);
+	for (i = 0; i < num; i++) {
+		val = nau8821_model_read(nau8821->model, regs[i]);
+		data[i][0] = val >> 8;
+		data[i][1] = val & 0xff;
+	}
+	spin_unlock(&nau8821->model->lock);
+
+	return true;
+}
+
+/* The regmap bus of the register model, accounted and logged as the I2C
+ * bus is.
+ */
+static int nau8821_model_bus_write(void *context, const void *data,
+	size_t count)
+{
+	struct nau8821 *nau8821 = context;
+	struct nau8821_model *model = nau8821->model;
+	const u8 *buf = data;
+	unsigned int reg = (buf[0] << 8) | buf[1];
+	size_t i, val_len = count - NAU8821_REG_ADDR_LEN / 8;
+
+	spin_lock(&model->lock);
+	for (i = NAU8821_REG_ADDR_LEN / 8; i + 1 < count; i += 2)
+		nau8821_model_write(model, reg + (i - NAU8821_REG_ADDR_LEN / 8) / 2,
+			(buf[i] << 8) | buf[i + 1]);
+	spin_unlock(&model->lock);
+	nau8821_io_account(nau8821, reg, val_len, count, true);
+	nau8821_io_log(nau8821, reg, buf + NAU8821_REG_ADDR_LEN / 8, val_len,
+		true);
+
+	return 0;
+}
+
+static int nau8821_model_bus_read(void *context, const void *reg_buf,
+	size_t reg_size, void *val_buf, size_t val_size)
+{
+	struct nau8821 *nau8821 = context;
+	struct nau8821_model *model = nau8821->model;
+	const u8 *reg_bytes = reg_buf;
+	unsigned int reg = (reg_bytes[0] << 8) | reg_bytes[1], val;
+	u8 *buf = val_buf;
+	size_t i;
+
+	spin_lock(&model->lock);
+	for (i = 0; i + 1 < val_size; i += 2) {
+		val = nau8821_model_read(model, reg + i / 2);
+		buf[i] = val >> 8;
+		buf[i + 1] = val & 0xff;
+	}
+	spin_unlock(&model->lock);
+	nau8821_io_account(nau8821, reg, val_size, reg_size + val_size, false);
+	nau8821_io_log(nau8821, reg, val_buf, val_size, false);
+
+	return 0;
+}
+
+static const struct regmap_bus nau8821_model_bus = {
+	.write = nau8821_model_bus_write,
+	.read = nau8821_model_bus_read,
+	.reg_format_endian_default = REGMAP_ENDIAN_BIG,
+	.val_format_endian_default = REGMAP_ENDIAN_BIG,
+};
+
+/* Most handler runs per delivery, in case the status is never cleared */
+#define NAU8821_MODEL_IRQ_LOOPS	16
+
+/* Run the interruption handler while the model holds the line active */
+static void nau8821_model_irq_work(struct work_struct *work)
+{
+	struct nau8821_model *model =
+		container_of(work, struct nau8821_model, irq_work);
+	struct nau8821 *nau8821 = model->nau8821;
+	unsigned int pending, i;
+
+	mutex_lock(&model->irq_lock);
+	for (i = 0; i < NAU8821_MODEL_IRQ_LOOPS && !model->irq_disabled; i++) {
+		spin_lock(&model->lock);
+		pending = nau8821_model_pending(model);
+		spin_unlock(&model->lock);
+		if (!pending)
+			break;
+		model->irqs++;
+		nau8821_interrupt(nau8821->irq, nau8821);
+	}
+	mutex_unlock(&model->irq_lock);
+}
+
+/* Complete an auto mode detection, after a handler run in progress */
+static void nau8821_model_detect_work(struct work_struct *work)
+{
+	struct nau8821_model *model =
+		container_of(work, struct nau8821_model, detect_work.work);
+
+	mutex_lock(&model->irq_lock);
+	spin_lock(&model->lock);
+	if (model->detecting && model->jack)
+		nau8821_model_raise(model, NAU8821_JACK_INSERT_DETECTED |
+			NAU8821_MIC_DETECT_IRQ);
+	model->detecting = false;
+	spin_unlock(&model->lock);
+	mutex_unlock(&model->irq_lock);
+}
+
+/* Wait until the model has nothing left to deliver, a detection started by
+ * the handler included.
+ */
+static void nau8821_model_settle(struct nau8821_model *model)
+{
+	flush_work(&model->irq_work);
+	while (flush_delayed_work(&model->detect_work))
+		flush_work(&model->irq_work);
+}
+
+static void nau8821_model_release(void *data)
+{
+	struct nau8821_model *model = data;
+
+	cancel_delayed_work_sync(&model->detect_work);
+	cancel_work_sync(&model->irq_work);
+}
+
+static int nau8821_model_init(struct nau8821 *nau8821)
+{
+	struct nau8821_model *model;
+	int ret;
+
+	model = devm_kzalloc(nau8821->dev, sizeof(*model), GFP_KERNEL);
+	if (!model)
+		return -ENOMEM;
+	model->nau8821 = nau8821;
+	spin_lock_init(&model->lock);
+	mutex_init(&model->irq_lock);
+	INIT_WORK(&model->irq_work, nau8821_model_irq_work);
+	INIT_DELAYED_WORK(&model->detect_work, nau8821_model_detect_work);
+	nau8821_model_reset(model);
+	/* Released after the component, which is unregistered first */
+	ret = devm_add_action_or_reset(nau8821->dev, nau8821_model_release,
+		model);
+	if (ret)
+		return ret;
+	nau8821->model = model;
+	dev_info(nau8821->dev, "Using the register model\n");
+
+	return 0;
+}
+
+/**
+ * nau8821_model_inject - change the jack of the model
+ * @nau8821: driver private data
+ * @ev: NAU8821_MODEL_EV_* event
+ *
+ * The model raises the status the codec would for the event and the
+ * interruption is handled before returning, so the caller can check the
+ * outcome right away.
+ */
+void nau8821_model_inject(struct nau8821 *nau8821, enum nau8821_model_ev ev)
+{
+	struct nau8821_model *model = nau8821->model;
+
+	spin_lock(&model->lock);
+	switch (ev) {
+	case NAU8821_MODEL_EV_INSERT:
+	case NAU8821_MODEL_EV_INSERT_MIC:
+		model->jack = true;
+		model->mic = ev == NAU8821_MODEL_EV_INSERT_MIC;
+		nau8821_model_detect(model);
+		break;
+	case NAU8821_MODEL_EV_EJECT:
+		model->jack = false;
+		model->mic = false;
+		model->detecting = false;
+		nau8821_model_raise(model, NAU8821_JACK_EJECT_DETECTED);
+		break;
+	case NAU8821_MODEL_EV_PRESS:
+		if (model->jack && model->mic)
+			nau8821_model_raise(model,
+				NAU8821_KEY_SHORT_PRESS_IRQ);
+		break;
+	case NAU8821_MODEL_EV_RELEASE:
+		if (model->jack && model->mic)
+			nau8821_model_raise(model, NAU8821_KEY_RELEASE_IRQ);
+		break;
+	default:
+		break;
+	}
+	spin_unlock(&model->lock);
+	nau8821_model_settle(model);
+}
+EXPORT_SYMBOL_GPL(nau8821_model_inject);
+
+/**
+ * nau8821_model_hold - hold the interruption of the model off
+ * @nau8821: driver private data
+ * @hold: hold it off, or deliver what was raised meanwhile
+ *
+ * Events injected while held off only latch their status, the way a cable
+ * bounces faster than the handler runs. Releasing delivers them and waits
+ * until the handler is done.
+ */
+void nau8821_model_hold(struct nau8821 *nau8821, bool hold)
+{
+	if (hold) {
+		nau8821_irq_disable(nau8821);
+		return;
+	}
+	nau8821_irq_enable(nau8821);
+	nau8821_model_settle(nau8821->model);
+}
+EXPORT_SYMBOL_GPL(nau8821_model_hold);
+
+/* Drop the registers back to their reset values, as a power loss does */
+void nau8821_model_power_loss(struct nau8821 *nau8821)
+{
+	spin_lock(&nau8821->model->lock);
+	nau8821_model_reset(nau8821->model);
+	spin_unlock(&nau8821->model->lock);
+}
+EXPORT_SYMBOL_GPL(nau8821_model_power_loss);
+
+/* Register value as the codec holds it, past the regmap cache */
+unsigned int nau8821_model_reg(struct nau8821 *nau8821, unsigned int reg)
+{
+	unsigned int val;
+
+	spin_lock(&nau8821->model->lock);
+	val = nau8821_model_read(nau8821->model, reg);
+	spin_unlock(&nau8821->model->lock);
+
+	return val;
+}
+EXPORT_SYMBOL_GPL(nau8821_model_reg);
+
+#else
+static bool nau8821_model_read_status(struct nau8821 *nau8821,
+	const unsigned int *regs, u8 (*data)[2], int num)
+{
+	return false;
+}
+#endif /* CONFIG_SND_SOC_NAU8821_MODEL */
+
+#define NAU8821_STATUS_MAX 4
+
+/* The registers separated by repeated starts in one I2C transfer */
+static int nau8821_status_xfer(struct nau8821 *nau8821,
+	const unsigned int *regs, u8 (*data)[2], int num)
+{
+	struct i2c_client *client = to_i2c_client(nau8821->dev);
+	struct i2c_msg xfer[NAU8821_STATUS_MAX * 2];
+	u8 addr[NAU8821_STATUS_MAX][2];
+	int i;
+
+	for (i = 0; i < num; i++) {
+		addr[i][0] = regs[i] >> 8;
+		addr[i][1] = regs[i] & 0xff;
+		xfer[i * 2].addr = client->addr;
+		xfer[i * 2].len = sizeof(addr[i]);
+		xfer[i * 2].buf = addr[i];
+		xfer[i * 2].flags = 0;
+		xfer[i * 2 + 1].addr = client->addr;
+		xfer[i * 2 + 1].len = sizeof(data[i]);
+		xfer[i * 2 + 1].buf = data[i];
+		xfer[i * 2 + 1].flags = I2C_M_RD;
+	}
+
+	return i2c_transfer(client->adapter, xfer, num * 2);
+}
+
+/* Read a few volatile status registers in one combined I2C transfer, the
+ * registers separated by repeated starts rather than each read paying for
+ * its own transfer. The registers need not be contiguous, the values come
+ * straight from the device and bypass the cache. The transfer is accounted
+ * once, the registers it covers once each. Like a regmap read of a
+ * volatile register, it fails with -EBUSY while the regmap is cache only.
+ */
+static int nau8821_read_status(struct nau8821 *nau8821,
+	const unsigned int *regs, unsigned int *vals, int num)
+{
+	struct nau8821_io_stats *stats = &nau8821->stats;
+	u8 data[NAU8821_STATUS_MAX][2];
+	int i, ret;
+
+	if (num <= 0 || num > NAU8821_STATUS_MAX)
+		return -EINVAL;
+	if (READ_ONCE(nau8821->cache_only))
+		return -EBUSY;
+
+	if (nau8821_model_read_status(nau8821, regs, data, num))
+		ret = num * 2;
+	else
+		ret = nau8821_status_xfer(nau8821, regs, data, num);
+
+	spin_lock(&nau8821->stats_lock);
+	stats->reads++;
+	stats->bytes += num * (NAU8821_REG_ADDR_LEN / 8 + sizeof(data[0]));
+	for (i = 0; i < num; i++)
+		if (regs[i] <= NAU8821_REG_MAX)
+			stats->reg_reads[regs[i]]++;
+	spin_unlock(&nau8821->stats_lock);
+
+	if (ret < 0)
+		return ret;
+	else if (ret != num * 2)
+		return -EIO;
+
+	for (i = 0; i < num; i++) {
+		vals[i] = (data[i][0] << 8) | data[i][1];
+		nau8821_io_log(nau8821, regs[i], data[i], sizeof(data[i]),
+			false);
+	}
+
+	return 0;
+}
+
+static const struct regmap_bus nau8821_regmap_bus = {
+	.write = nau8821_bus_write,
+	.read = nau8821_bus_read,
+	.reg_format_endian_default = REGMAP_ENDIAN_BIG,
+	.val_format_endian_default = REGMAP_ENDIAN_BIG,
+};
+
+static const struct regmap_config nau8821_regmap_config = {
+	.val_bits = NAU8821_REG_DATA_LEN,
+	.reg_bits = NAU8821_REG_ADDR_LEN,
+
+	.max_register = NAU8821_REG_MAX,
+	.rd_table = &nau8821_readable_table,
+	.wr_table = &nau8821_writeable_table,
+	.volatile_table = &nau8821_volatile_table,
+
+	.cache_type = REGCACHE_FLAT,
+	.reg_defaults = nau8821_reg_defaults,
+	.num_reg_defaults = ARRAY_SIZE(nau8821_reg_defaults),
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int nau8821_i2c_stats_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_io_stats *stats;
+	struct nau8821_op_stats *op;
+	unsigned int i, j;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	spin_lock(&nau8821->stats_lock);
+	memcpy(stats, &nau8821->stats, sizeof(*stats));
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_printf(s, "total: reads %llu writes %llu bytes %llu\n\n",
+		stats->reads, stats->writes, stats->bytes);
+
+	seq_puts(s, "op         calls    reads   writes    bytes   avg_us   max_us\n");
+	for (i = 0; i < NAU8821_OP_NUM; i++) {
+		op = &stats->op[i];
+		seq_printf(s, "%-10s %5llu %8llu %8llu %8llu %8llu %8llu\n",
+			nau8821_op_names[i], op->calls, op->reads, op->writes,
+			op->bytes, op->calls ?
+			div64_u64(op->total_ns, op->calls * NSEC_PER_USEC) : 0,
+			div_u64(op->max_ns, NSEC_PER_USEC));
+	}
+
+	seq_puts(s, "\nlatency histogram, bucket n counts [2^(n-1), 2^n) us\n");
+	for (i = 0; i < NAU8821_OP_NUM; i++) {
+		seq_printf(s, "%-10s", nau8821_op_names[i]);
+		for (j = 0; j < NAU8821_HIST_BUCKETS; j++)
+			seq_printf(s, " %u", stats->op[i].hist[j]);
+		seq_putc(s, '\n');
+	}
+
+	seq_puts(s, "\nreg    reads   writes\n");
+	for (i = 0; i <= NAU8821_REG_MAX; i++) {
+		if (!stats->reg_reads[i] && !stats->reg_writes[i])
+			continue;
+		seq_printf(s, "0x%02x %7u %8u\n", i, stats->reg_reads[i],
+			stats->reg_writes[i]);
+	}
+	kfree(stats);
+
+	return 0;
+}
+
+static int nau8821_i2c_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_i2c_stats_show, inode->i_private);
+}
+
+/* Any write clears the per-register and per-operation counters */
+static ssize_t nau8821_i2c_stats_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_io_stats *stats = &nau8821->stats;
+
+	spin_lock(&nau8821->stats_lock);
+	memset(stats->reg_reads, 0, sizeof(stats->reg_reads));
+	memset(stats->reg_writes, 0, sizeof(stats->reg_writes));
+	memset(stats->op, 0, sizeof(stats->op));
+	memset(stats->jack_ev, 0, sizeof(stats->jack_ev));
+	memset(stats->jack_noops, 0, sizeof(stats->jack_noops));
+	memset(stats->jack_det, 0, sizeof(stats->jack_det));
+	memset(stats->jack_stage, 0, sizeof(stats->jack_stage));
+	stats->jack_spurious = 0;
+	spin_unlock(&nau8821->stats_lock);
+
+	return count;
+}
+
+static const struct file_operations nau8821_i2c_stats_fops = {
+	.open = nau8821_i2c_stats_open,
+	.read = seq_read,
+	.write = nau8821_i2c_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Cached registers touched by nau8821_hw_params() */
+static const unsigned int nau8821_bench_hw_params_regs[] = {
+	NAU8821_REG_CLK_DIVIDER,
+	NAU8821_REG_I2S_PCM_CTRL1,
+	NAU8821_REG_I2S_PCM_CTRL2,
+	NAU8821_REG_ADC_RATE,
+	NAU8821_REG_DAC_CTRL1,
+};
+
+/* Cached registers touched by the jack detection interrupt path */
+static const unsigned int nau8821_bench_irq_regs[] = {
+	NAU8821_REG_JACK_DET_CTRL,
+	NAU8821_REG_INTERRUPT_MASK,
+	NAU8821_REG_INTERRUPT_DIS_CTRL,
+	NAU8821_REG_MIC_BIAS,
+	NAU8821_REG_ENA_CTRL,
+};
+
+#define NAU8821_BENCH_LOOPS	1000
+
+/*
+ * Time the CPU cost of cached register accesses: a regmap_read() and a
+ * no-op regmap_update_bits() (mask 0, so nothing is written) on each
+ * register, which covers the access table checks and the cache lookup
+ * without any bus traffic.
+ */
+static void nau8821_cache_bench_run(struct seq_file *s,
+	struct regmap *regmap, const char *name,
+	const unsigned int *regs, int num)
+{
+	unsigned int val, accesses = NAU8821_BENCH_LOOPS * num;
+	u64 read_ns, update_ns;
+	ktime_t start;
+	int i, j;
+
+	start = ktime_get();
+	for (i = 0; i < NAU8821_BENCH_LOOPS; i++)
+		for (j = 0; j < num; j++)
+			regmap_read(regmap, regs[j], &val);
+	read_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < NAU8821_BENCH_LOOPS; i++)
+		for (j = 0; j < num; j++)
+			regmap_update_bits(regmap, regs[j], 0, 0);
+	update_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	seq_printf(s, "%-10s %8u %12llu %12llu\n", name, accesses,
+		div_u64(read_ns, accesses), div_u64(update_ns, accesses));
+}
+
+static int nau8821_cache_bench_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+
+	seq_puts(s, "path       accesses  read_ns/acc update_ns/acc\n");
+	nau8821_cache_bench_run(s, nau8821->regmap, "hw_params",
+		nau8821_bench_hw_params_regs,
+		ARRAY_SIZE(nau8821_bench_hw_params_regs));
+	nau8821_cache_bench_run(s, nau8821->regmap, "irq",
+		nau8821_bench_irq_regs, ARRAY_SIZE(nau8821_bench_irq_regs));
+
+	return 0;
+}
+
+static int nau8821_cache_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_cache_bench_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_cache_bench_fops = {
+	.open = nau8821_cache_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int nau8821_fll_lock_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_fll_lock_stats lock[NAU8821_FLL_SRC_NUM];
+	unsigned int i;
+
+	spin_lock(&nau8821->stats_lock);
+	memcpy(lock, nau8821->fll_lock, sizeof(lock));
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_puts(s, "src  settle_us  count   min_us   avg_us   max_us\n");
+	for (i = 0; i < NAU8821_FLL_SRC_NUM; i++)
+		seq_printf(s, "%-4s %9u %6llu %8llu %8llu %8llu\n",
+			nau8821_fll_src_names[i], lock[i].settle_us,
+			lock[i].count, div_u64(lock[i].min_ns, NSEC_PER_USEC),
+			lock[i].count ? div64_u64(lock[i].total_ns,
+			lock[i].count * NSEC_PER_USEC) : 0,
+			div_u64(lock[i].max_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int nau8821_fll_lock_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_fll_lock_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_fll_lock_fops = {
+	.open = nau8821_fll_lock_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const char * const nau8821_irq_clear_mode_names[] = {
+	[NAU8821_IRQ_CLEAR_PROBE] = "probe",
+	[NAU8821_IRQ_CLEAR_BULK] = "bulk",
+	[NAU8821_IRQ_CLEAR_PER_BIT] = "per-bit",
+};
+
+static int nau8821_irq_clear_mode_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	enum nau8821_irq_clear_mode mode = READ_ONCE(nau8821->irq_clear_mode);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_irq_clear_mode_names); i++)
+		seq_printf(s, i == mode ? "%s[%s]" : "%s%s", i ? " " : "",
+			nau8821_irq_clear_mode_names[i]);
+	seq_putc(s, '\n');
+
+	return 0;
+}
+
+static int nau8821_irq_clear_mode_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_irq_clear_mode_show,
+		inode->i_private);
+}
+
+/* Select the acknowledge mode by name; "probe" checks bulk again. */
+static ssize_t nau8821_irq_clear_mode_write(struct file *file,
+	const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct nau8821 *nau8821 = s->private;
+	char buf[16];
+	int mode;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	mode = sysfs_match_string(nau8821_irq_clear_mode_names, buf);
+	if (mode < 0)
+		return mode;
+	WRITE_ONCE(nau8821->irq_clear_mode, mode);
+
+	return count;
+}
+
+static const struct file_operations nau8821_irq_clear_mode_fops = {
+	.open = nau8821_irq_clear_mode_open,
+	.read = seq_read,
+	.write = nau8821_irq_clear_mode_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int nau8821_jack_fsm_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_op_stats ev[NAU8821_JACK_EV_NUM];
+	struct nau8821_op_stats det[NAU8821_JACK_DET_NUM];
+	u64 noops[NAU8821_JACK_EV_NUM];
+	unsigned int i;
+
+	spin_lock(&nau8821->stats_lock);
+	memcpy(ev, nau8821->stats.jack_ev, sizeof(ev));
+	memcpy(det, nau8821->stats.jack_det, sizeof(det));
+	memcpy(noops, nau8821->stats.jack_noops, sizeof(noops));
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_printf(s, "state: %s\n\n",
+		nau8821_jack_state_names[READ_ONCE(nau8821->jack_state)]);
+	seq_puts(s, "event       count  noops    reads   writes    bytes   avg_us   max_us\n");
+	for (i = 0; i < NAU8821_JACK_EV_NUM; i++)
+		seq_printf(s, "%-11s %5llu %6llu %8llu %8llu %8llu %8llu %8llu\n",
+			nau8821_jack_ev_names[i], ev[i].calls, noops[i],
+			ev[i].reads, ev[i].writes, ev[i].bytes, ev[i].calls ?
+			div64_u64(ev[i].total_ns, ev[i].calls * NSEC_PER_USEC) :
+			0, div_u64(ev[i].max_ns, NSEC_PER_USEC));
+
+	seq_puts(s, "\ndetection   count   reads   writes    bytes   avg_us   max_us\n");
+	for (i = 0; i < NAU8821_JACK_DET_NUM; i++)
+		seq_printf(s, "%-11s %5llu %7llu %8llu %8llu %8llu %8llu\n",
+			nau8821_jack_det_names[i], det[i].calls, det[i].reads,
+			det[i].writes, det[i].bytes, det[i].calls ?
+			div64_u64(det[i].total_ns,
+			det[i].calls * NSEC_PER_USEC) : 0,
+			div_u64(det[i].max_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int nau8821_jack_fsm_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_jack_fsm_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_jack_fsm_fops = {
+	.open = nau8821_jack_fsm_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int nau8821_jack_latency_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_io_stats *stats;
+	struct nau8821_op_stats *st;
+	unsigned int i, j, k;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	spin_lock(&nau8821->stats_lock);
+	memcpy(stats, &nau8821->stats, sizeof(*stats));
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_printf(s, "spurious: %llu\n\n", stats->jack_spurious);
+	seq_puts(s, "outcome   stage      count   reads  writes   avg_us   max_us\n");
+	for (i = 0; i < NAU8821_JACK_OUT_NUM; i++)
+		for (j = 0; j < NAU8821_JACK_STAGE_NUM; j++) {
+			st = &stats->jack_stage[i][j];
+			seq_printf(s, "%-9s %-10s %5llu %7llu %7llu %8llu %8llu\n",
+				nau8821_jack_out_names[i],
+				nau8821_jack_stages[j].name, st->calls,
+				st->reads, st->writes, st->calls ?
+				div64_u64(st->total_ns,
+				st->calls * NSEC_PER_USEC) : 0,
+				div_u64(st->max_ns, NSEC_PER_USEC));
+		}
+
+	seq_puts(s, "\nlatency histogram, bucket n counts [2^(n-1), 2^n) us\n");
+	for (i = 0; i < NAU8821_JACK_OUT_NUM; i++)
+		for (j = 0; j < NAU8821_JACK_STAGE_NUM; j++) {
+			seq_printf(s, "%-9s %-10s", nau8821_jack_out_names[i],
+				nau8821_jack_stages[j].name);
+			for (k = 0; k < NAU8821_HIST_BUCKETS; k++)
+				seq_printf(s, " %u",
+					stats->jack_stage[i][j].hist[k]);
+			seq_putc(s, '\n');
+		}
+	kfree(stats);
+
+	return 0;
+}
+
+static int nau8821_jack_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_jack_latency_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_jack_latency_fops = {
+	.open = nau8821_jack_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void nau8821_pct_show(struct seq_file *s, const char *name,
+	const char *dir, const struct nau8821_op_stats *st)
+{
+	seq_printf(s, "%-12s %-4s %7llu %8llu %8llu %8llu\n", name, dir,
+		st->calls, nau8821_hist_pct(st, 50), nau8821_hist_pct(st, 99),
+		div_u64(st->max_ns, NSEC_PER_USEC));
+}
+
+static int nau8821_latency_pct_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_io_stats *stats;
+	unsigned int i;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	spin_lock(&nau8821->stats_lock);
+	memcpy(stats, &nau8821->stats, sizeof(*stats));
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_puts(s, "phase             calls   p50_us   p99_us   max_us\n");
+	for (i = 0; i < NAU8821_OP_NUM; i++)
+		nau8821_pct_show(s, nau8821_op_names[i], "", &stats->op[i]);
+	for (i = 0; i < NAU8821_DAPM_EV_NUM; i++) {
+		nau8821_pct_show(s, nau8821_dapm_ev_names[i], "pmu",
+			&stats->dapm[i][0]);
+		nau8821_pct_show(s, nau8821_dapm_ev_names[i], "pmd",
+			&stats->dapm[i][1]);
+	}
+	for (i = 0; i < NAU8821_JACK_EV_NUM; i++)
+		nau8821_pct_show(s, nau8821_jack_ev_names[i], "jack",
+			&stats->jack_ev[i]);
+	kfree(stats);
+
+	return 0;
+}
+
+static int nau8821_latency_pct_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_latency_pct_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_latency_pct_fops = {
+	.open = nau8821_latency_pct_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+struct nau8821_io_log_dump {
+	size_t len;
+	struct nau8821_io_log_entry entry[NAU8821_IO_LOG_SIZE];
+};
+
+/* Copy the consistent entries of the ring, oldest first, at open */
+static int nau8821_io_log_open(struct inode *inode, struct file *file)
+{
+	struct nau8821 *nau8821 = inode->i_private;
+	struct nau8821_io_log_entry *e, *out;
+	struct nau8821_io_log_dump *dump;
+	unsigned int seq, first, i;
+
+	dump = kvzalloc(sizeof(*dump), GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
+
+	seq = atomic_read(&nau8821->io_log_seq);
+	first = seq > NAU8821_IO_LOG_SIZE ? seq - NAU8821_IO_LOG_SIZE + 1 : 1;
+	for (i = first; i != seq + 1; i++) {
+		e = &nau8821->io_log[(i - 1) & (NAU8821_IO_LOG_SIZE - 1)];
+		out = &dump->entry[dump->len];
+		if (READ_ONCE(e->seq) != i)
+			continue;
+		smp_rmb();
+		*out = *e;
+		smp_rmb();
+		if (READ_ONCE(e->seq) != i || out->seq != i)
+			continue;
+		dump->len++;
+	}
+	file->private_data = dump;
+
+	return 0;
+}
+
+static ssize_t nau8821_io_log_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct nau8821_io_log_dump *dump = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, dump->entry,
+		dump->len * sizeof(dump->entry[0]));
+}
+
+static int nau8821_dump_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
 
-	/* Restart the jack detection process at auto mode */
-	nau8821_restart_jack_detection(regmap);
+	return 0;
 }
 
-static int nau8821_jack_insert(struct nau8821 *nau8821)
-{
-	struct snd_soc_dapm_context *dapm = nau8821->dapm;
-	struct regmap *regmap = nau8821->regmap;
-	int jack_status_reg, mic_detected;
-	int type = 0;
+static const struct file_operations nau8821_io_log_fops = {
+	.open = nau8821_io_log_open,
+	.read = nau8821_io_log_read,
+	.llseek = default_llseek,
+	.release = nau8821_dump_release,
+};
 
-	regmap_read(regmap, NAU8821_REG_I2C_DEVICE_ID, &jack_status_reg);
-	mic_detected = jack_status_reg & NAU8821_MICDET;
+struct nau8821_snap_blob {
+	size_t len;
+	u8 data[];
+};
 
-	if (mic_detected) {
-		dev_dbg(nau8821->dev, "OMTP (micgnd1) mic connected\n");
-		type = SND_JACK_HEADSET;
+#define NAU8821_SNAP_MAX_SIZE	(sizeof(struct nau8821_snap_hdr) + \
+	(NAU8821_REG_MAX + 1) * (sizeof(struct nau8821_snap_run) + sizeof(u16)))
 
-		/* Attach 2kOhm Resistor from MICBIAS to MICGND1 */
-		regmap_update_bits(regmap, NAU8821_REG_MIC_BIAS,
-			NAU8821_MICBIAS_JKR2, NAU8821_MICBIAS_JKR2);
-		snd_soc_dapm_force_enable_pin(dapm, "MICBIAS");
-		snd_soc_dapm_sync(dapm);
-	} else {
-		type = SND_JACK_HEADPHONE;
+/* Split the readable ranges into runs of the same volatility */
+static unsigned int nau8821_snap_runs(struct nau8821_snap_run *runs)
+{
+	const struct regmap_range *range;
+	struct nau8821_snap_run *run = NULL;
+	unsigned int i, reg, num = 0;
+	u16 flags;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_readable_ranges); i++) {
+		range = &nau8821_readable_ranges[i];
+		for (reg = range->range_min; reg <= range->range_max; reg++) {
+			flags = regmap_reg_in_ranges(reg,
+				nau8821_volatile_ranges,
+				ARRAY_SIZE(nau8821_volatile_ranges)) ?
+				NAU8821_SNAP_RUN_VOLATILE : 0;
+			if (run && run->flags == flags &&
+				run->first + run->count == reg) {
+				run->count++;
+				continue;
+			}
+			run = &runs[num++];
+			run->first = reg;
+			run->count = 1;
+			run->flags = flags;
+		}
 	}
 
-	return type;
+	return num;
 }
 
-#define NAU8821_BUTTON SND_JACK_BTN_0
-
-static irqreturn_t nau8821_interrupt(int irq, void *data)
+/**
+ * nau8821_snapshot - capture every readable register
+ * @nau8821: driver private data
+ * @blob: buffer of NAU8821_SNAP_MAX_SIZE bytes for the image
+ *
+ * Each run of volatile registers costs one raw bulk read from the codec;
+ * the other registers come from the cache without bus traffic. A run that
+ * fails to read, e.g. while the codec is suspended, is flagged and zeroed
+ * rather than failing the whole capture.
+ */
+static void nau8821_snapshot(struct nau8821 *nau8821,
+	struct nau8821_snap_blob *blob)
 {
-	struct nau8821 *nau8821 = (struct nau8821 *)data;
-	struct regmap *regmap = nau8821->regmap;
-	int active_irq, clear_irq = 0, event = 0, event_mask = 0;
-
-	if (regmap_read(regmap, NAU8821_REG_IRQ_STATUS, &active_irq)) {
-		dev_err(nau8821->dev, "failed to read irq status\n");
-		return IRQ_NONE;
-	}
-	dev_dbg(nau8821->dev, "IRQ 0x%x\n", active_irq);
-
-	if ((active_irq & NAU8821_JACK_EJECT_IRQ_MASK) == 
-		NAU8821_JACK_EJECT_DETECTED) {
-		nau8821_eject_jack(nau8821);
-		event_mask |= SND_JACK_HEADSET;
-		clear_irq = NAU8821_JACK_EJECT_IRQ_MASK;
-	} else if (active_irq & NAU8821_KEY_SHORT_PRESS_IRQ) {
-		event |= NAU8821_BUTTON;
-		event_mask |= NAU8821_BUTTON;
-		clear_irq = NAU8821_KEY_SHORT_PRESS_IRQ;
-	} else if (active_irq & NAU8821_KEY_RELEASE_IRQ) {
-		event_mask = NAU8821_BUTTON;
-		clear_irq = NAU8821_KEY_RELEASE_IRQ;
-	} else if ((active_irq & NAU8821_JACK_INSERT_IRQ_MASK) ==
-		NAU8821_JACK_INSERT_DETECTED) {
-		/* One more step to check GPIO status directly. Thus, the
-		 * driver can confirm the real insertion interruption because
-		 * the intrruption at manual mode has bypassed debounce
-		 * circuit which can get rid of unstable status.
-		 */
-		if (nau8821_is_jack_inserted(regmap)) {
-			if (nau8821->clk_id == NAU8821_CLK_DIS) {
-				/* Turn off insertion interruption at manual mode */
-				regmap_update_bits(regmap,
-					NAU8821_REG_INTERRUPT_DIS_CTRL,
-					NAU8821_IRQ_INSERT_DIS,
-					NAU8821_IRQ_INSERT_DIS);
-				regmap_update_bits(regmap,
-					NAU8821_REG_INTERRUPT_MASK,
-					NAU8821_IRQ_INSERT_EN,
-					NAU8821_IRQ_INSERT_EN);
-				/* Enable interruption for jack type detection
-				 * which can detect microphone and jack type.
-				 */
-				nau8821_setup_auto_irq(nau8821);
-			} else {
-				event |= nau8821_jack_insert(nau8821);
-				event_mask |= SND_JACK_HEADSET;
-				nau8821_sema_release(nau8821);
-			}
+	struct nau8821_snap_hdr *hdr = (struct nau8821_snap_hdr *)blob->data;
+	struct nau8821_snap_run *runs = (struct nau8821_snap_run *)(hdr + 1);
+	struct nau8821_snap_run *run;
+	struct nau8821_op_ctx ctx;
+	unsigned int i, j, val;
+	__be16 *raw;
+	u16 *vals;
+	u64 start;
+
+	nau8821_op_begin(nau8821, &ctx, NAU8821_OP_SNAPSHOT);
+	start = ktime_get_ns();
+	hdr->magic = NAU8821_SNAP_MAGIC;
+	hdr->version = NAU8821_SNAP_VERSION;
+	hdr->ts_ns = start;
+	hdr->num_runs = nau8821_snap_runs(runs);
+	hdr->num_regs = 0;
+	vals = (u16 *)(runs + hdr->num_runs);
+
+	for (i = 0; i < hdr->num_runs; i++) {
+		run = &runs[i];
+		if (run->flags & NAU8821_SNAP_RUN_VOLATILE) {
+			raw = (__be16 *)vals;
+			if (regmap_raw_read(nau8821->regmap, run->first, raw,
+				run->count * sizeof(*raw)))
+				run->flags |= NAU8821_SNAP_RUN_ERROR;
+			for (j = 0; j < run->count; j++)
+				vals[j] = run->flags & NAU8821_SNAP_RUN_ERROR ?
+					0 : be16_to_cpu(raw[j]);
 		} else {
-			dev_warn(nau8821->dev, "Headset completion IRQ fired but no headset connected\n");
-			nau8821_eject_jack(nau8821);
+			for (j = 0; j < run->count; j++) {
+				if (regmap_read(nau8821->regmap,
+					run->first + j, &val)) {
+					run->flags |= NAU8821_SNAP_RUN_ERROR;
+					val = 0;
+				}
+				vals[j] = val;
+			}
 		}
+		vals += run->count;
+		hdr->num_regs += run->count;
 	}
+	hdr->dur_ns = min_t(u64, ktime_get_ns() - start, U32_MAX);
+	blob->len = (u8 *)vals - blob->data;
+	nau8821_op_end(nau8821, &ctx);
+}
 
-	if (!clear_irq)
-		clear_irq = active_irq;
-	/* clears the rightmost interruption */
-	regmap_write(regmap, NAU8821_REG_INT_CLR_KEY_STATUS, clear_irq);
+static int nau8821_regs_bin_open(struct inode *inode, struct file *file)
+{
+	struct nau8821_snap_blob *blob;
 
-	if (event_mask)
-		snd_soc_jack_report(nau8821->jack, event, event_mask);
+	blob = kvzalloc(sizeof(*blob) + NAU8821_SNAP_MAX_SIZE, GFP_KERNEL);
+	if (!blob)
+		return -ENOMEM;
+	nau8821_snapshot(inode->i_private, blob);
+	file->private_data = blob;
 
-	return IRQ_HANDLED;
+	return 0;
 }
 
-static const struct regmap_config nau8821_regmap_config = {
-	.val_bits = NAU8821_REG_DATA_LEN,
-	.reg_bits = NAU8821_REG_ADDR_LEN,
+static ssize_t nau8821_regs_bin_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct nau8821_snap_blob *blob = file->private_data;
 
-	.max_register = NAU8821_REG_MAX,
-	.readable_reg = nau8821_readable_reg,
-	.writeable_reg = nau8821_writeable_reg,
-	.volatile_reg = nau8821_volatile_reg,
+	return simple_read_from_buffer(buf, count, ppos, blob->data,
+		blob->len);
+}
 
-	.cache_type = REGCACHE_RBTREE,
-	.reg_defaults = nau8821_reg_defaults,
-	.num_reg_defaults = ARRAY_SIZE(nau8821_reg_defaults),
+static const struct file_operations nau8821_regs_bin_fops = {
+	.open = nau8821_regs_bin_open,
+	.read = nau8821_regs_bin_read,
+	.llseek = default_llseek,
+	.release = nau8821_dump_release,
 };
 
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+#endif /* CONFIG_SND_SOC_NAU8821_MODEL */
+
+static int nau8821_jd_wait_show(struct seq_file *s, void *data)
+{
+	struct nau8821 *nau8821 = s->private;
+	struct nau8821_jd_wait_stats st;
+	int state = atomic_read(&nau8821->jd_state);
+
+	spin_lock(&nau8821->stats_lock);
+	st = nau8821->jd_wait;
+	spin_unlock(&nau8821->stats_lock);
+
+	seq_printf(s, "state: %s\n", nau8821_jd_state_names[state]);
+	seq_printf(s, "calls: %llu waits: %llu timeouts: %llu\n",
+		st.calls, st.waits, st.timeouts);
+	seq_printf(s, "wait avg_us: %llu max_us: %llu limit_ms: %u\n",
+		st.waits ? div64_u64(st.total_ns,
+		st.waits * NSEC_PER_USEC) : 0,
+		div_u64(st.max_ns, NSEC_PER_USEC), st.timeout_ms);
+
+	return 0;
+}
+
+static int nau8821_jd_wait_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nau8821_jd_wait_show, inode->i_private);
+}
+
+static const struct file_operations nau8821_jd_wait_fops = {
+	.open = nau8821_jd_wait_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void nau8821_debugfs_init(struct nau8821 *nau8821,
+	struct dentry *root)
+{
+	char name[32];
+	unsigned int i;
+
+	debugfs_create_file("i2c_stats", 0644, root, nau8821,
+		&nau8821_i2c_stats_fops);
+	debugfs_create_file("cache_bench", 0444, root, nau8821,
+		&nau8821_cache_bench_fops);
+	debugfs_create_file("fll_lock", 0444, root, nau8821,
+		&nau8821_fll_lock_fops);
+	debugfs_create_file("irq_clear_mode", 0644, root, nau8821,
+		&nau8821_irq_clear_mode_fops);
+	debugfs_create_file("jd_wait", 0444, root, nau8821,
+		&nau8821_jd_wait_fops);
+	debugfs_create_file("jack_fsm", 0444, root, nau8821,
+		&nau8821_jack_fsm_fops);
+	debugfs_create_file("jack_latency", 0444, root, nau8821,
+		&nau8821_jack_latency_fops);
+	debugfs_create_file("latency_pct", 0444, root, nau8821,
+		&nau8821_latency_pct_fops);
+	debugfs_create_file("io_log", 0400, root, nau8821,
+		&nau8821_io_log_fops);
+	debugfs_create_file("regs_bin", 0400, root, nau8821,
+		&nau8821_regs_bin_fops);
+	debugfs_create_u32("jd_timeout_ms", 0644, root,
+		&nau8821->jd_wait.timeout_ms);
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+	if (nau8821->model) {
+		debugfs_create_u64("model_irqs", 0444, root,
+			&nau8821->model->irqs);
+	}
+#endif
+	for (i = 0; i < NAU8821_FLL_SRC_NUM; i++) {
+		snprintf(name, sizeof(name), "fll_settle_%s_us",
+			nau8821_fll_src_names[i]);
+		debugfs_create_u32(name, 0644, root,
+			&nau8821->fll_lock[i].settle_us);
+	}
+}
+#endif
+
 static int nau8821_component_probe(struct snd_soc_component *component)
 {
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 	struct snd_soc_dapm_context *dapm = snd_soc_component_get_dapm(component);
 
 	nau8821->dapm = dapm;
+#ifdef CONFIG_DEBUG_FS
+	nau8821_debugfs_init(nau8821, component->debugfs_root);
+#endif
 	//Enable mic bias temprarily when no jack detection running.
 	snd_soc_dapm_force_enable_pin(nau8821->dapm, "MICBIAS");
 	snd_soc_dapm_sync(nau8821->dapm);
@@ -1102,9 +3391,11 @@ static void nau8821_codec_remove(struct snd_soc_component *component)
 {
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 
+	cancel_work_sync(&nau8821->resume_work);
+	cancel_work_sync(&nau8821->jack_disarm_work);
+	cancel_delayed_work_sync(&nau8821->adc_work);
 	if (nau8821->irq)
-		/* Reset semaphore */
-		nau8821_sema_reset(nau8821);
+		nau8821_jd_finish(nau8821, NAU8821_JD_IDLE);
 
 }
 
@@ -1175,54 +3466,153 @@ static int nau8821_calc_fll_param(unsigned int fll_in,
 	return 0;
 }
 
-static void nau8821_fll_apply(struct nau8821 *nau8821,
+/* CLK_DIVIDER and FLL1 to FLL8 are contiguous and written as one burst */
+#define NAU8821_FLL_IMAGE_LEN \
+	(NAU8821_REG_FLL8 - NAU8821_REG_CLK_DIVIDER + 1)
+
+static inline void nau8821_fll_image_update(u16 *image, unsigned int reg,
+	unsigned int mask, unsigned int val)
+{
+	u16 *p = &image[reg - NAU8821_REG_CLK_DIVIDER];
+
+	*p = (*p & ~mask) | (val & mask);
+}
+
+/**
+ * nau8821_fll_apply - program the FLL and the clock source selection
+ * @nau8821: driver private data
+ * @fll_param: FLL parameters computed by nau8821_calc_fll_param()
+ *
+ * The new values of CLK_DIVIDER and FLL1 to FLL8 are computed on a copy of
+ * the register cache and the span between the first and the last changed
+ * register is flushed with a single bulk write, so the FLL is never left
+ * half-configured between separate transfers. The caller holds clk_lock,
+ * so the other configuration paths cannot change the clock registers
+ * between the cache read and the write.
+ */
+static int nau8821_fll_apply(struct nau8821 *nau8821,
 		struct nau8821_fll *fll_param)
 {
 	struct regmap *regmap = nau8821->regmap;
+	u16 cur[NAU8821_FLL_IMAGE_LEN], image[NAU8821_FLL_IMAGE_LEN];
+	struct nau8821_op_ctx op;
+	int i, ret = 0, first = -1, last = -1;
+	unsigned int val;
 
-	regmap_update_bits(regmap, NAU8821_REG_CLK_DIVIDER,
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_FLL_APPLY);
+	for (i = 0; i < NAU8821_FLL_IMAGE_LEN; i++) {
+		ret = regmap_read(regmap, NAU8821_REG_CLK_DIVIDER + i, &val);
+		if (ret) {
+			dev_err(nau8821->dev, "Failed to read FLL register %x: %d\n",
+				NAU8821_REG_CLK_DIVIDER + i, ret);
+			goto out;
+		}
+		cur[i] = image[i] = val;
+	}
+
+	nau8821_fll_image_update(image, NAU8821_REG_CLK_DIVIDER,
 		NAU8821_CLK_SRC_MASK | NAU8821_CLK_MCLK_SRC_MASK,
 		NAU8821_CLK_SRC_MCLK | fll_param->mclk_src);
 	/* Make DSP operate at high speed for better performance. */
-	regmap_update_bits(regmap, NAU8821_REG_FLL1,
+	nau8821_fll_image_update(image, NAU8821_REG_FLL1,
 		NAU8821_FLL_RATIO_MASK | NAU8821_ICTRL_LATCH_MASK,
 		fll_param->ratio | (0x6 << NAU8821_ICTRL_LATCH_SFT));
 	/* FLL 24-bit fractional input */
-	regmap_write(regmap, NAU8821_REG_FLL7,
+	nau8821_fll_image_update(image, NAU8821_REG_FLL7, 0xffff,
 		(fll_param->fll_frac >> 16) & 0xff);
-	regmap_write(regmap, NAU8821_REG_FLL8, fll_param->fll_frac & 0xffff);
+	nau8821_fll_image_update(image, NAU8821_REG_FLL8, 0xffff,
+		fll_param->fll_frac & 0xffff);
 	/* FLL 10-bit integer input */
-	regmap_update_bits(regmap, NAU8821_REG_FLL3,
+	nau8821_fll_image_update(image, NAU8821_REG_FLL3,
 		NAU8821_FLL_INTEGER_MASK, fll_param->fll_int);
 	/* FLL pre-scaler */
-	regmap_update_bits(regmap, NAU8821_REG_FLL4,
+	nau8821_fll_image_update(image, NAU8821_REG_FLL4,
 		NAU8821_HIGHBW_EN | NAU8821_FLL_REF_DIV_MASK,
 		NAU8821_HIGHBW_EN |
 		(fll_param->clk_ref_div << NAU8821_FLL_REF_DIV_SFT));
 	/* select divided VCO input */
-	regmap_update_bits(regmap, NAU8821_REG_FLL5,
+	nau8821_fll_image_update(image, NAU8821_REG_FLL5,
 		NAU8821_FLL_CLK_SW_MASK, NAU8821_FLL_CLK_SW_REF);
 	/* Disable free-running mode */
-	regmap_update_bits(regmap,
-		NAU8821_REG_FLL6, NAU8821_DCO_EN, 0);
+	nau8821_fll_image_update(image, NAU8821_REG_FLL6, NAU8821_DCO_EN, 0);
 	if (fll_param->fll_frac) {
 		/* set FLL loop filter enable and cutoff frequency at 500Khz */
-		regmap_update_bits(regmap, NAU8821_REG_FLL5,
+		nau8821_fll_image_update(image, NAU8821_REG_FLL5,
 			NAU8821_FLL_PDB_DAC_EN | NAU8821_FLL_LOOP_FTR_EN |
 			NAU8821_FLL_FTR_SW_MASK,
 			NAU8821_FLL_PDB_DAC_EN | NAU8821_FLL_LOOP_FTR_EN |
 			NAU8821_FLL_FTR_SW_FILTER);
-		regmap_update_bits(regmap, NAU8821_REG_FLL6,
+		nau8821_fll_image_update(image, NAU8821_REG_FLL6,
 			NAU8821_SDM_EN | NAU8821_CUTOFF500,
 			NAU8821_SDM_EN | NAU8821_CUTOFF500);
 	} else {
 		/* disable FLL loop filter and cutoff frequency */
-		regmap_update_bits(regmap, NAU8821_REG_FLL5,
+		nau8821_fll_image_update(image, NAU8821_REG_FLL5,
 			NAU8821_FLL_PDB_DAC_EN | NAU8821_FLL_LOOP_FTR_EN |
 			NAU8821_FLL_FTR_SW_MASK, NAU8821_FLL_FTR_SW_ACCU);
-		regmap_update_bits(regmap, NAU8821_REG_FLL6,
+		nau8821_fll_image_update(image, NAU8821_REG_FLL6,
 			NAU8821_SDM_EN | NAU8821_CUTOFF500, 0);
 	}
+
+	for (i = 0; i < NAU8821_FLL_IMAGE_LEN; i++) {
+		if (image[i] == cur[i])
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+	}
+	if (first < 0)
+		goto out;
+
+	ret = regmap_bulk_write(regmap, NAU8821_REG_CLK_DIVIDER + first,
+		&image[first], last - first + 1);
+	if (ret)
+		dev_err(nau8821->dev, "Failed to write FLL: %d\n", ret);
+out:
+	nau8821_op_end(nau8821, &op);
+	return ret;
+}
+
+static enum nau8821_fll_src nau8821_fll_src(struct nau8821 *nau8821)
+{
+	switch (nau8821->clk_id) {
+	case NAU8821_CLK_FLL_BLK:
+		return NAU8821_FLL_SRC_BCLK;
+	case NAU8821_CLK_FLL_FS:
+		return NAU8821_FLL_SRC_FS;
+	default:
+		/* FLL3 selects MCLK as the reference after reset */
+		return NAU8821_FLL_SRC_MCLK;
+	}
+}
+
+/**
+ * nau8821_fll_wait_lock - wait for the FLL to lock after programming
+ * @nau8821: driver private data
+ *
+ * The chip exposes no FLL lock status, so sleep for the settle time of
+ * the current reference input, which can be tuned per board in debugfs,
+ * and record the time actually spent before the switch to the VCO.
+ */
+static void nau8821_fll_wait_lock(struct nau8821 *nau8821)
+{
+	struct nau8821_fll_lock_stats *lock =
+		&nau8821->fll_lock[nau8821_fll_src(nau8821)];
+	unsigned int settle_us = READ_ONCE(lock->settle_us);
+	ktime_t start = ktime_get();
+	u64 ns;
+
+	usleep_range(settle_us, settle_us + settle_us / 4 + 1);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&nau8821->stats_lock);
+	if (!lock->count || ns < lock->min_ns)
+		lock->min_ns = ns;
+	if (ns > lock->max_ns)
+		lock->max_ns = ns;
+	lock->total_ns += ns;
+	lock->count++;
+	spin_unlock(&nau8821->stats_lock);
 }
 
 /**
@@ -1243,6 +3633,7 @@ static int nau8821_set_fll(struct snd_soc_component *component, int pll_id, int
 	struct nau8821_fll fll_set_param, *fll_param = &fll_set_param;
 	int ret, fs;
 
+	nau8821_wait_resume(nau8821);
 	fs = freq_out >> 8;
 	ret = nau8821_calc_fll_param(freq_in, fs, fll_param);
 	if (ret) {
@@ -1254,11 +3645,40 @@ static int nau8821_set_fll(struct snd_soc_component *component, int pll_id, int
 		fll_param->mclk_src, fll_param->ratio, fll_param->fll_frac,
 		fll_param->fll_int, fll_param->clk_ref_div);
 
-	nau8821_fll_apply(nau8821, fll_param);
-	mdelay(2);
-	regmap_update_bits(nau8821->regmap, NAU8821_REG_CLK_DIVIDER,
+	/* The clock switches of jack detection and suspend invalidate the
+	 * cache under clk_lock, so it is only trusted with the lock held.
+	 */
+	nau8821_clk_lock(nau8821);
+	if (nau8821->fll_valid && nau8821->fll_clk_id == nau8821->clk_id &&
+		nau8821->fll_freq_in == freq_in &&
+		nau8821->fll_freq_out == freq_out) {
+		dev_dbg(nau8821->dev, "FLL already set for %d to %d\n",
+			freq_in, freq_out);
+		nau8821_clk_unlock(nau8821);
+		trace_nau8821_set_fll(nau8821->dev, freq_in, freq_out,
+			&nau8821->fll, true, 0);
+		return 0;
+	}
+	nau8821->fll_valid = false;
+	ret = nau8821_fll_apply(nau8821, fll_param);
+	if (ret)
+		goto out;
+	nau8821_fll_wait_lock(nau8821);
+	ret = regmap_update_bits(nau8821->regmap, NAU8821_REG_CLK_DIVIDER,
 		NAU8821_CLK_SRC_MASK, NAU8821_CLK_SRC_VCO);
-	return 0;
+	if (ret)
+		goto out;
+
+	nau8821->fll = *fll_param;
+	nau8821->fll_clk_id = nau8821->clk_id;
+	nau8821->fll_freq_in = freq_in;
+	nau8821->fll_freq_out = freq_out;
+	nau8821->fll_valid = true;
+out:
+	nau8821_clk_unlock(nau8821);
+	trace_nau8821_set_fll(nau8821->dev, freq_in, freq_out, fll_param,
+		false, ret);
+	return ret;
 }
 
 static void nau8821_configure_mclk_as_sysclk(struct regmap *regmap)
@@ -1272,25 +3692,29 @@ static void nau8821_configure_mclk_as_sysclk(struct regmap *regmap)
 		NAU8821_ICTRL_LATCH_MASK, 0);
 }
 
-static int nau8821_configure_sysclk(struct nau8821 *nau8821,
+/* Switch the system clock with clk_lock held */
+static int nau8821_configure_sysclk_locked(struct nau8821 *nau8821,
 	int clk_id, unsigned int freq)
 {
 	struct regmap *regmap = nau8821->regmap;
+	int old_clk_id = nau8821->clk_id;
 
 	switch (clk_id) {
 	case NAU8821_CLK_DIS:
 		/* Clock provided externally and disable internal VCO clock */
 		nau8821_configure_mclk_as_sysclk(regmap);
+		nau8821->fll_valid = false;
 		break;
 	case NAU8821_CLK_MCLK:
-		nau8821_sema_acquire(nau8821, HZ);
 		nau8821_configure_mclk_as_sysclk(regmap);
+		nau8821->fll_valid = false;
 		/* MCLK not changed by clock tree */
 		regmap_update_bits(regmap, NAU8821_REG_CLK_DIVIDER,
 			NAU8821_CLK_MCLK_SRC_MASK, 0);
-		nau8821_sema_release(nau8821);
 		break;
 	case NAU8821_CLK_INTERNAL:
+		/* Both branches move the clock source away from the FLL */
+		nau8821->fll_valid = false;
 		if (nau8821_is_jack_inserted(regmap)) {
 			regmap_update_bits(regmap, NAU8821_REG_FLL6,
 				NAU8821_DCO_EN, NAU8821_DCO_EN);
@@ -1315,7 +3739,6 @@ static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 		}
 		break;
 	case NAU8821_CLK_FLL_MCLK:
-		nau8821_sema_acquire(nau8821, HZ);
 		/* Higher FLL reference input frequency can only set lower
 		 * gain error, such as 0000 for input reference from MCLK
 		 * 12.288Mhz.
@@ -1323,10 +3746,8 @@ static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 		regmap_update_bits(regmap, NAU8821_REG_FLL3,
 			NAU8821_FLL_CLK_SRC_MASK | NAU8821_GAIN_ERR_MASK,
 			NAU8821_FLL_CLK_SRC_MCLK | 0);
-		nau8821_sema_release(nau8821);
 		break;
 	case NAU8821_CLK_FLL_BLK:
-		nau8821_sema_acquire(nau8821, HZ);
 		/* If FLL reference input is from low frequency source,
 		 * higher error gain can apply such as 0xf which has
 		 * the most sensitive gain error correction threshold,
@@ -1337,10 +3758,8 @@ static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 			NAU8821_FLL_CLK_SRC_MASK | NAU8821_GAIN_ERR_MASK,
 			NAU8821_FLL_CLK_SRC_BLK |
 			(0xf << NAU8821_GAIN_ERR_SFT));
-		nau8821_sema_release(nau8821);
 		break;
 	case NAU8821_CLK_FLL_FS:
-		nau8821_sema_acquire(nau8821, HZ);
 		/* If FLL reference input is from low frequency source,
 		 * higher error gain can apply such as 0xf which has
 		 * the most sensitive gain error correction threshold,
@@ -1351,7 +3770,6 @@ static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 			NAU8821_FLL_CLK_SRC_MASK | NAU8821_GAIN_ERR_MASK,
 			NAU8821_FLL_CLK_SRC_FS |
 			(0xf << NAU8821_GAIN_ERR_SFT));
-		nau8821_sema_release(nau8821);
 		break;
 	default:
 		dev_err(nau8821->dev, "Invalid clock id (%d)\n", clk_id);
@@ -1360,14 +3778,36 @@ static int nau8821_configure_sysclk(struct nau8821 *nau8821,
 	nau8821->clk_id = clk_id;
 	dev_dbg(nau8821->dev, "Sysclk is %dHz and clock id is %d\n", freq,
 		nau8821->clk_id);
+	trace_nau8821_sysclk(nau8821->dev, old_clk_id, clk_id, freq);
 
 	return 0;
 }
 
+/* The clock switches of jack detection come from the interrupt thread,
+ * which must not wait for the detection it is carrying out, so they take
+ * clk_lock without the jack detection gate.
+ */
+static int nau8821_configure_sysclk(struct nau8821 *nau8821,
+	int clk_id, unsigned int freq)
+{
+	int ret;
+
+	if (clk_id == NAU8821_CLK_DIS || clk_id == NAU8821_CLK_INTERNAL)
+		mutex_lock(&nau8821->clk_lock);
+	else
+		nau8821_clk_lock(nau8821);
+	ret = nau8821_configure_sysclk_locked(nau8821, clk_id, freq);
+	nau8821_clk_unlock(nau8821);
+
+	return ret;
+}
+
 static int nau8821_set_sysclk(struct snd_soc_component *component, int clk_id,
 	int source, unsigned int freq, int dir)
 {
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+
+	nau8821_wait_resume(nau8821);
 	return nau8821_configure_sysclk(nau8821, clk_id, freq);
 }
 
@@ -1379,7 +3819,7 @@ static int nau8821_resume_setup(struct nau8821 *nau8821)
 	nau8821_configure_sysclk(nau8821, NAU8821_CLK_DIS, 0);
 	if (nau8821->irq) {
 		/* Clear all interruption status */
-		nau8821_int_status_clear_all(regmap);
+		nau8821_int_status_clear_all(nau8821);
 
 		/* Enable both insertion and ejection interruptions, and then
 		 * bypass de-bounce circuit.
@@ -1390,6 +3830,7 @@ static int nau8821_resume_setup(struct nau8821 *nau8821)
 			NAU8821_JACK_DET_DB_BYPASS, NAU8821_JACK_DET_DB_BYPASS);
 		regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_DIS_CTRL,
 			NAU8821_IRQ_INSERT_DIS | NAU8821_IRQ_EJECT_DIS, 0);
+		nau8821->jack_state = NAU8821_JACK_UNKNOWN;
 	}
 
 	return 0;
@@ -1401,6 +3842,17 @@ static int nau8821_set_bias_level(struct snd_soc_component *component,
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 	struct regmap *regmap = nau8821->regmap;
 
+	/* Every DAPM power-up from the suspended state raises the bias first */
+	nau8821_wait_resume(nau8821);
+
+	mutex_lock(&nau8821->clk_lock);
+	/* The stream clock keeping auto mode armed is going away */
+	if (level == SND_SOC_BIAS_PREPARE && nau8821->bias_on &&
+		nau8821->irq && nau8821->jack_state == NAU8821_JACK_ARMED)
+		schedule_work(&nau8821->jack_disarm_work);
+	nau8821->bias_on = level == SND_SOC_BIAS_ON;
+	mutex_unlock(&nau8821->clk_lock);
+
 	switch (level) {
 	case SND_SOC_BIAS_ON:
 		break;
@@ -1415,12 +3867,12 @@ static int nau8821_set_bias_level(struct snd_soc_component *component,
 		break;
 
 	case SND_SOC_BIAS_OFF:
+		nau8821_adc_cancel(nau8821);
 		/* HPL/HPR short to ground */
 		regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
 			NAU8821_SPKR_DWN1R | NAU8821_SPKR_DWN1L, 0);
 		if (nau8821->irq) {
-			/* Reset semaphore */
-			nau8821_sema_reset(nau8821);
+			nau8821_jd_finish(nau8821, NAU8821_JD_IDLE);
 			/* Reset the configuration of jack type for detection */
 			/* Detach 2kOhm Resistors from MICBIAS to MICGND1/2 */
 			regmap_update_bits(regmap, NAU8821_REG_MIC_BIAS,
@@ -1442,34 +3894,212 @@ static int nau8821_set_bias_level(struct snd_soc_component *component,
 	return 0;
 }
 
+/**
+ * nau8821_regcache_sync - restore the register cache to the codec
+ * @nau8821: driver private data
+ *
+ * Used on resume instead of regcache_sync(), which writes the registers
+ * one at a time. Cached registers holding their post-reset default are
+ * skipped, and runs of contiguous registers to restore (FLL1-FLL8, the
+ * DRC block, ...) are written with one bulk transfer each. Volatile
+ * registers, including the BIQ coefficients, are not cached and so not
+ * restored.
+ *
+ * Returns 0 on success or negative error code.
+ */
+static int nau8821_regcache_sync(struct nau8821 *nau8821)
+{
+	struct regmap *regmap = nau8821->regmap;
+	const struct reg_default *def;
+	u16 run[NAU8821_REG_MAX + 1];
+	unsigned int i, val, run_reg = 0, run_len = 0, regs = 0, writes = 0;
+	ktime_t start = ktime_get();
+	int ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_reg_defaults) && !ret; i++) {
+		def = &nau8821_reg_defaults[i];
+		if (!regmap_check_range_table(regmap, def->reg,
+			&nau8821_writeable_table) ||
+			regmap_check_range_table(regmap, def->reg,
+			&nau8821_volatile_table))
+			continue;
+		ret = regmap_read(regmap, def->reg, &val);
+		if (ret)
+			break;
+		if (val == def->def)
+			continue;
+
+		if (run_len && def->reg != run_reg + run_len) {
+			ret = regmap_bulk_write(regmap, run_reg, run, run_len);
+			writes++;
+			run_len = 0;
+		}
+		if (!run_len)
+			run_reg = def->reg;
+		run[run_len++] = val;
+		regs++;
+	}
+	if (!ret && run_len) {
+		ret = regmap_bulk_write(regmap, run_reg, run, run_len);
+		writes++;
+	}
+	trace_nau8821_resume(nau8821->dev, false, regs, writes,
+		ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	return ret;
+}
+
+/**
+ * nau8821_regs_retained - check whether the codec kept its registers
+ * @nau8821: driver private data
+ *
+ * BIAS_ADJ is used as the sentinel: the driver sets the VMID bit at
+ * initialization and never clears it, while a power loss resets the
+ * register to its default. A hardware read matching the cache means the
+ * codec stayed powered. The register file is then in sync with the cache
+ * unless a register was written while the cache was the only target, see
+ * nau8821_cache_written().
+ */
+static bool nau8821_regs_retained(struct nau8821 *nau8821)
+{
+	struct regmap *regmap = nau8821->regmap;
+	unsigned int cached, val;
+	int ret;
+
+	ret = regmap_read(regmap, NAU8821_REG_BIAS_ADJ, &cached);
+	if (ret || !(cached & NAU8821_BIAS_VMID))
+		return false;
+
+	regcache_cache_bypass(regmap, true);
+	ret = regmap_read(regmap, NAU8821_REG_BIAS_ADJ, &val);
+	regcache_cache_bypass(regmap, false);
+
+	return !ret && val == cached;
+}
+
+/* regmap has no way to ask for cache only, the raw status read keeps to
+ * this copy
+ */
+static void nau8821_cache_only(struct nau8821 *nau8821, bool enable)
+{
+	regcache_cache_only(nau8821->regmap, enable);
+	WRITE_ONCE(nau8821->cache_only, enable);
+}
+
+/* Cached, non-volatile registers in nau8821_reg_defaults order */
+static bool nau8821_cache_reg(struct nau8821 *nau8821, unsigned int i,
+	unsigned int *reg, unsigned int *val)
+{
+	*reg = nau8821_reg_defaults[i].reg;
+	if (regmap_check_range_table(nau8821->regmap, *reg,
+		&nau8821_volatile_table))
+		return false;
+
+	return !regmap_read(nau8821->regmap, *reg, val);
+}
+
+/* Remember the register cache as the codec goes to suspend */
+static void nau8821_cache_save(struct nau8821 *nau8821)
+{
+	unsigned int i, reg, val;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_reg_defaults); i++)
+		if (nau8821_cache_reg(nau8821, i, &reg, &val))
+			nau8821->suspend_regs[reg] = val;
+}
+
+/**
+ * nau8821_cache_written - check for writes made during suspend
+ * @nau8821: driver private data
+ *
+ * With the cache only, a control or DAPM write between suspend and resume
+ * changes the cache and never reaches the codec. Comparing the cache with
+ * its copy taken at suspend finds such writes without any bus traffic.
+ */
+static bool nau8821_cache_written(struct nau8821 *nau8821)
+{
+	unsigned int i, reg, val;
+
+	for (i = 0; i < ARRAY_SIZE(nau8821_reg_defaults); i++)
+		if (nau8821_cache_reg(nau8821, i, &reg, &val) &&
+			val != nau8821->suspend_regs[reg])
+			return true;
+
+	return false;
+}
+
 static int __maybe_unused nau8821_suspend(struct snd_soc_component *component)
 {
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 
+	flush_work(&nau8821->resume_work);
+	cancel_work_sync(&nau8821->jack_disarm_work);
 	if (nau8821->irq)
-		disable_irq(nau8821->irq);
+		nau8821_irq_disable(nau8821);
 	snd_soc_component_force_bias_level(component, SND_SOC_BIAS_OFF);
 	/* Power down codec power; don't suppoet button wakeup */
 	snd_soc_dapm_disable_pin(nau8821->dapm, "MICBIAS");
 	snd_soc_dapm_sync(nau8821->dapm);
-	regcache_cache_only(nau8821->regmap, true);
-	regcache_mark_dirty(nau8821->regmap);
+	nau8821_adc_cancel(nau8821);
+	/* Whether the registers need restoring is decided on resume */
+	nau8821_cache_save(nau8821);
+	nau8821_cache_only(nau8821, true);
+	/* The chip may lose power; program the FLL again after resume */
+	mutex_lock(&nau8821->clk_lock);
+	nau8821->fll_valid = false;
+	mutex_unlock(&nau8821->clk_lock);
 
 	return 0;
 }
 
-static int __maybe_unused nau8821_resume(struct snd_soc_component *component)
+static void nau8821_resume_restore(struct nau8821 *nau8821, bool retained)
 {
-	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+	struct nau8821_op_ctx op;
 
-	regcache_cache_only(nau8821->regmap, false);
-	regcache_sync(nau8821->regmap);
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_RESUME);
+	if (!retained && nau8821_regcache_sync(nau8821))
+		dev_err(nau8821->dev, "Failed to restore registers\n");
 	if (nau8821->irq) {
-		/* Hold semaphore to postpone playback happening
-		 * until jack detection done.
+		/* Postpone playback until the detection of a jack that is
+		 * already plugged is done, without a jack go ahead.
 		 */
-		nau8821_sema_acquire(nau8821, 0);
-		enable_irq(nau8821->irq);
+		if (nau8821_is_jack_inserted(nau8821->regmap))
+			nau8821_jd_start(nau8821);
+		else
+			nau8821_jd_finish(nau8821, NAU8821_JD_IDLE);
+		nau8821_irq_enable(nau8821);
+	}
+	complete_all(&nau8821->resume_done);
+	nau8821_op_end(nau8821, &op);
+}
+
+static void nau8821_resume_work(struct work_struct *work)
+{
+	struct nau8821 *nau8821 =
+		container_of(work, struct nau8821, resume_work);
+
+	nau8821_resume_restore(nau8821, false);
+}
+
+static int __maybe_unused nau8821_resume(struct snd_soc_component *component)
+{
+	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
+
+	ktime_t start = ktime_get();
+	bool written, retained;
+
+	reinit_completion(&nau8821->resume_done);
+	written = nau8821_cache_written(nau8821);
+	nau8821_cache_only(nau8821, false);
+	retained = !written && nau8821_regs_retained(nau8821);
+	if (retained) {
+		trace_nau8821_resume(nau8821->dev, true, 0, 0,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+		nau8821_resume_restore(nau8821, true);
+	} else if (async_resume) {
+		schedule_work(&nau8821->resume_work);
+	} else {
+		nau8821_resume_restore(nau8821, false);
 	}
 
 	return 0;
@@ -1509,6 +4139,14 @@ int nau8821_enable_jack_detect(struct snd_soc_component *component,
 	struct nau8821 *nau8821 = snd_soc_component_get_drvdata(component);
 	int ret;
 
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+	/* The register model delivers its interruptions itself */
+	if (nau8821->model) {
+		nau8821->jack = jack;
+		return 0;
+	}
+#endif
+
 	ret = devm_request_threaded_irq(nau8821->dev, nau8821->irq, NULL,
 		nau8821_interrupt, IRQF_TRIGGER_LOW | IRQF_ONESHOT,
 		"nau8821", nau8821);
@@ -1580,135 +4218,164 @@ static int nau8821_read_device_properties(struct device *dev,
 	return 0;
 }
 
-static void nau8821_init_regs(struct nau8821 *nau8821)
-{
-	struct regmap *regmap = nau8821->regmap;
-
+/*
+ * Static part of the register initialization after reset, applied in a
+ * single transaction together with the board specific fields. The order
+ * is the power-up order: Bias/VMID comes up ahead of the global bias.
+ */
+static const struct nau8821_txn_entry nau8821_init_seq[] = {
 	/* Enable Bias/Vmid */
-	regmap_update_bits(regmap, NAU8821_REG_BIAS_ADJ,
-		NAU8821_BIAS_VMID, NAU8821_BIAS_VMID);
-	regmap_update_bits(regmap, NAU8821_REG_BOOST,
-		NAU8821_GLOBAL_BIAS_EN, NAU8821_GLOBAL_BIAS_EN);
+	{ NAU8821_REG_BIAS_ADJ, NAU8821_BIAS_VMID, NAU8821_BIAS_VMID },
+	{ NAU8821_REG_BOOST, NAU8821_GLOBAL_BIAS_EN, NAU8821_GLOBAL_BIAS_EN },
 	/* VMID Tieoff setting and enable TESTDAC.
 	 * This sets the analog DAC inputs to a '0' input signal to avoid
 	 * any glitches due to power up transients in both the analog and
 	 * digital DAC circuit.
 	 */
-	regmap_update_bits(regmap, NAU8821_REG_BIAS_ADJ,
-		NAU8821_BIAS_VMID_SEL_MASK | NAU8821_BIAS_TESTDAC_EN,
-		(nau8821->vref_impedance << NAU8821_BIAS_VMID_SEL_SFT) |
-		NAU8821_BIAS_TESTDAC_EN);
+	{ NAU8821_REG_BIAS_ADJ, NAU8821_BIAS_TESTDAC_EN,
+		NAU8821_BIAS_TESTDAC_EN },
 	/* Disable short Frame Sync detection logic */
-	regmap_update_bits(regmap, NAU8821_REG_LEFT_TIME_SLOT,
-		NAU8821_DIS_FS_SHORT_DET, NAU8821_DIS_FS_SHORT_DET);
+	{ NAU8821_REG_LEFT_TIME_SLOT, NAU8821_DIS_FS_SHORT_DET,
+		NAU8821_DIS_FS_SHORT_DET },
 	/* Disable Boost Driver, Automatic Short circuit protection enable */
-	regmap_update_bits(regmap, NAU8821_REG_BOOST,
-		NAU8821_PRECHARGE_DIS | NAU8821_HP_BOOST_DIS |
+	{ NAU8821_REG_BOOST, NAU8821_PRECHARGE_DIS | NAU8821_HP_BOOST_DIS |
 		NAU8821_HP_BOOST_G_DIS | NAU8821_SHORT_SHUTDOWN_EN,
 		NAU8821_PRECHARGE_DIS | NAU8821_HP_BOOST_DIS |
-		NAU8821_HP_BOOST_G_DIS | NAU8821_SHORT_SHUTDOWN_EN);
+		NAU8821_HP_BOOST_G_DIS | NAU8821_SHORT_SHUTDOWN_EN },
 	/* Class G timer 64ms */
-	regmap_update_bits(regmap, NAU8821_REG_CLASSG_CTRL,
-		NAU8821_CLASSG_TIMER_MASK,
-		0x20 << NAU8821_CLASSG_TIMER_SFT);
+	{ NAU8821_REG_CLASSG_CTRL, NAU8821_CLASSG_TIMER_MASK,
+		0x20 << NAU8821_CLASSG_TIMER_SFT },
 	/* Class AB bias current to 2x, DAC Capacitor enable MSB/LSB */
-	regmap_update_bits(regmap, NAU8821_REG_ANALOG_CONTROL_2,
-		NAU8821_HP_NON_CLASSG_CURRENT_2xADJ |
+	{ NAU8821_REG_ANALOG_CONTROL_2, NAU8821_HP_NON_CLASSG_CURRENT_2xADJ |
 		NAU8821_DAC_CAPACITOR_MSB | NAU8821_DAC_CAPACITOR_LSB,
 		NAU8821_HP_NON_CLASSG_CURRENT_2xADJ |
-		NAU8821_DAC_CAPACITOR_MSB | NAU8821_DAC_CAPACITOR_LSB);
+		NAU8821_DAC_CAPACITOR_MSB | NAU8821_DAC_CAPACITOR_LSB },
 	/* Disable DACR/L power */
-	regmap_update_bits(regmap, NAU8821_REG_CHARGE_PUMP,
-		NAU8821_POWER_DOWN_DACR | NAU8821_POWER_DOWN_DACL, 0);
+	{ NAU8821_REG_CHARGE_PUMP,
+		NAU8821_POWER_DOWN_DACR | NAU8821_POWER_DOWN_DACL, 0 },
 	/* DAC clock delay 2ns, VREF */
-	regmap_update_bits(regmap, NAU8821_REG_RDAC,
-		NAU8821_DAC_CLK_DELAY_MASK | NAU8821_DAC_VREF_MASK,
+	{ NAU8821_REG_RDAC, NAU8821_DAC_CLK_DELAY_MASK | NAU8821_DAC_VREF_MASK,
 		(0x2 << NAU8821_DAC_CLK_DELAY_SFT) |
-		(0x3 << NAU8821_DAC_VREF_SFT));
-
-	regmap_update_bits(regmap, NAU8821_REG_MIC_BIAS,
-		NAU8821_MICBIAS_VOLTAGE_MASK, nau8821->micbias_voltage);
+		(0x3 << NAU8821_DAC_VREF_SFT) },
 	/* Default oversampling/decimations settings are unusable
 	 * (audible hiss). Set it to something better.
 	 */
-	regmap_update_bits(regmap, NAU8821_REG_ADC_RATE,
-		NAU8821_ADC_SYNC_DOWN_MASK, NAU8821_ADC_SYNC_DOWN_64);
-	regmap_update_bits(regmap, NAU8821_REG_DAC_CTRL1,
-		NAU8821_DAC_OVERSAMPLE_MASK, NAU8821_DAC_OVERSAMPLE_64);
+	{ NAU8821_REG_ADC_RATE, NAU8821_ADC_SYNC_DOWN_MASK,
+		NAU8821_ADC_SYNC_DOWN_64 },
+	{ NAU8821_REG_DAC_CTRL1, NAU8821_DAC_OVERSAMPLE_MASK,
+		NAU8821_DAC_OVERSAMPLE_64 },
+};
+
+static void nau8821_init_regs(struct nau8821 *nau8821)
+{
+	struct nau8821_txn txn;
+	struct nau8821_op_ctx op;
+	int i;
+
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_INIT_REGS);
+	nau8821_txn_init(&txn, nau8821->regmap);
+	for (i = 0; i < ARRAY_SIZE(nau8821_init_seq); i++)
+		nau8821_txn_update(&txn, nau8821_init_seq[i].reg,
+			nau8821_init_seq[i].mask, nau8821_init_seq[i].val);
+	nau8821_txn_update(&txn, NAU8821_REG_BIAS_ADJ,
+		NAU8821_BIAS_VMID_SEL_MASK,
+		nau8821->vref_impedance << NAU8821_BIAS_VMID_SEL_SFT);
+	nau8821_txn_update(&txn, NAU8821_REG_MIC_BIAS,
+		NAU8821_MICBIAS_VOLTAGE_MASK, nau8821->micbias_voltage);
+	if (nau8821_txn_commit(&txn))
+		dev_err(nau8821->dev, "Failed to initialize registers\n");
+	nau8821_op_end(nau8821, &op);
 }
 
 static int nau8821_setup_irq(struct nau8821 *nau8821)
 {
-	struct regmap *regmap = nau8821->regmap;
-
-	sema_init(&nau8821->jd_sem, 1);
+	struct nau8821_txn txn;
+	struct nau8821_op_ctx op;
+	int ret;
 
+	nau8821_op_begin(nau8821, &op, NAU8821_OP_SETUP_IRQ);
+	nau8821_txn_init(&txn, nau8821->regmap);
 	/* Jack detection */
-	regmap_update_bits(regmap, NAU8821_REG_GPIO12_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_GPIO12_CTRL,
 		NAU8821_JKDET_OUTPUT_EN,
 		nau8821->jkdet_enable ? 0 : NAU8821_JKDET_OUTPUT_EN);
-	regmap_update_bits(regmap, NAU8821_REG_GPIO12_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_GPIO12_CTRL,
 		NAU8821_JKDET_PULL_EN,
 		nau8821->jkdet_pull_enable ? 0 : NAU8821_JKDET_PULL_EN);
-	regmap_update_bits(regmap, NAU8821_REG_GPIO12_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_GPIO12_CTRL,
 		NAU8821_JKDET_PULL_UP,
 		nau8821->jkdet_pull_up ? NAU8821_JKDET_PULL_UP : 0);
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_JACK_DET_CTRL,
 		NAU8821_JACK_POLARITY,
 		/* jkdet_polarity - 1  is for active-low */
 		nau8821->jkdet_polarity ? 0 : NAU8821_JACK_POLARITY);
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_JACK_DET_CTRL,
 		NAU8821_JACK_INSERT_DEBOUNCE_MASK,
 		nau8821->jack_insert_debounce <<
 		NAU8821_JACK_INSERT_DEBOUNCE_SFT);
-	regmap_update_bits(regmap, NAU8821_REG_JACK_DET_CTRL,
+	nau8821_txn_update(&txn, NAU8821_REG_JACK_DET_CTRL,
 		NAU8821_JACK_EJECT_DEBOUNCE_MASK,
 		nau8821->jack_eject_debounce <<
 		NAU8821_JACK_EJECT_DEBOUNCE_SFT);
 	/* Pull up IRQ pin */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_MASK,
+	nau8821_txn_update(&txn, NAU8821_REG_INTERRUPT_MASK,
 		NAU8821_IRQ_PIN_PULL_UP | NAU8821_IRQ_PIN_PULL_EN |
 		NAU8821_IRQ_OUTPUT_EN, NAU8821_IRQ_PIN_PULL_UP |
 		NAU8821_IRQ_PIN_PULL_EN | NAU8821_IRQ_OUTPUT_EN);
 	/* Disable interruption before codec initiation done */
 	/* Mask unneeded IRQs: 1 - disable, 0 - enable */
-	regmap_update_bits(regmap, NAU8821_REG_INTERRUPT_MASK, 0x3f5, 0x3f5);
+	nau8821_txn_update(&txn, NAU8821_REG_INTERRUPT_MASK, 0x3f5, 0x3f5);
+	ret = nau8821_txn_commit(&txn);
+	nau8821_op_end(nau8821, &op);
 
-	return 0;
+	return ret;
 }
 
-static int nau8821_i2c_probe(struct i2c_client *i2c,
-	const struct i2c_device_id *id)
+/* Probe the codec on @bus, with nau8821->dev and the properties set up */
+static int nau8821_probe(struct nau8821 *nau8821, const struct regmap_bus *bus,
+	int irq)
 {
-	struct device *dev = &i2c->dev;
-	struct nau8821 *nau8821 = dev_get_platdata(&i2c->dev);
-	int ret, value;
-
-	if (!nau8821) {
-		nau8821 = devm_kzalloc(dev, sizeof(*nau8821), GFP_KERNEL);
-		if (!nau8821)
-			return -ENOMEM;
-		nau8821_read_device_properties(dev, nau8821);
-	}
-	i2c_set_clientdata(i2c, nau8821);
+	struct device *dev = nau8821->dev;
+	int i, ret, value;
+
+	spin_lock_init(&nau8821->stats_lock);
+	mutex_init(&nau8821->adc_lock);
+	INIT_DELAYED_WORK(&nau8821->adc_work, nau8821_adc_work);
+	INIT_WORK(&nau8821->resume_work, nau8821_resume_work);
+	INIT_WORK(&nau8821->jack_disarm_work, nau8821_jack_disarm_work);
+	init_completion(&nau8821->resume_done);
+	complete_all(&nau8821->resume_done);
+	mutex_init(&nau8821->clk_lock);
+	atomic_set(&nau8821->jd_state, NAU8821_JD_IDLE);
+	init_completion(&nau8821->jd_done);
+	complete_all(&nau8821->jd_done);
+	nau8821->jd_wait.timeout_ms = NAU8821_JD_TIMEOUT_MS;
+	for (i = 0; i < NAU8821_FLL_SRC_NUM; i++)
+		nau8821->fll_lock[i].settle_us = NAU8821_FLL_SETTLE_US;
+
+	nau8821->io_op = NAU8821_OP_NUM;
+	nau8821->io_log = devm_kcalloc(dev, NAU8821_IO_LOG_SIZE,
+		sizeof(*nau8821->io_log), GFP_KERNEL);
+	if (!nau8821->io_log)
+		return -ENOMEM;
 
-	nau8821->regmap = devm_regmap_init_i2c(i2c, &nau8821_regmap_config);
+	nau8821->regmap = devm_regmap_init(dev, bus, nau8821,
+		&nau8821_regmap_config);
 
 #if 0
 	ret = regmap_write(nau8821->regmap, NAU8821_REG_RESET, 0x00);
 		if (ret) {
-			dev_err(&i2c->dev,"i2c write error");
+			dev_err(dev,"i2c write error");
 		}
 
 	ret = regmap_read(nau8821->regmap, NAU8821_REG_I2C_DEVICE_ID, &val);
 		if (ret) {
-			dev_err(&i2c->dev,"i2c read error");
+			dev_err(dev,"i2c read error");
 		}
 #endif		
 	if (IS_ERR(nau8821->regmap))
 		return PTR_ERR(nau8821->regmap);
-	nau8821->dev = dev;
-	nau8821->irq = i2c->irq;
+	nau8821->irq = irq;
 	nau8821_print_device_properties(nau8821);
 
 	nau8821_reset_chip(nau8821->regmap);
@@ -1719,13 +4386,64 @@ static int nau8821_i2c_probe(struct i2c_client *i2c,
 	}
 	nau8821_init_regs(nau8821);
 
-	if (i2c->irq)
+	if (nau8821->irq)
 		nau8821_setup_irq(nau8821);
 	
-	return devm_snd_soc_register_component(&i2c->dev, &nau8821_component_driver,
+	return devm_snd_soc_register_component(dev, &nau8821_component_driver,
 		&nau8821_dai, 1);
 }
 
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+/**
+ * nau8821_model_probe - probe the codec on the register model
+ * @dev: device the component is registered on
+ *
+ * The component is the one the I2C driver registers, with the regmap on
+ * the register model and its interruptions delivered by the model. It
+ * goes away with the devres of @dev.
+ *
+ * Return: the driver private data, or an ERR_PTR().
+ */
+struct nau8821 *nau8821_model_probe(struct device *dev)
+{
+	struct nau8821 *nau8821;
+	int ret;
+
+	nau8821 = devm_kzalloc(dev, sizeof(*nau8821), GFP_KERNEL);
+	if (!nau8821)
+		return ERR_PTR(-ENOMEM);
+	nau8821_read_device_properties(dev, nau8821);
+	dev_set_drvdata(dev, nau8821);
+	nau8821->dev = dev;
+
+	ret = nau8821_model_init(nau8821);
+	if (!ret)
+		ret = nau8821_probe(nau8821, &nau8821_model_bus,
+			NAU8821_MODEL_IRQ);
+
+	return ret ? ERR_PTR(ret) : nau8821;
+}
+EXPORT_SYMBOL_GPL(nau8821_model_probe);
+#endif
+
+static int nau8821_i2c_probe(struct i2c_client *i2c,
+	const struct i2c_device_id *id)
+{
+	struct device *dev = &i2c->dev;
+	struct nau8821 *nau8821 = dev_get_platdata(&i2c->dev);
+
+	if (!nau8821) {
+		nau8821 = devm_kzalloc(dev, sizeof(*nau8821), GFP_KERNEL);
+		if (!nau8821)
+			return -ENOMEM;
+		nau8821_read_device_properties(dev, nau8821);
+	}
+	i2c_set_clientdata(i2c, nau8821);
+	nau8821->dev = dev;
+
+	return nau8821_probe(nau8821, &nau8821_regmap_bus, i2c->irq);
+}
+
 static int nau8821_i2c_remove(struct i2c_client *client)
 {
 	return 0;
@@ -1758,6 +4476,7 @@ static struct i2c_driver nau8821_driver = {
 		.name = "nau8821",
 		.of_match_table = of_match_ptr(nau8821_of_ids),
 		.acpi_match_table = ACPI_PTR(nau8821_acpi_match),
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = nau8821_i2c_probe,
 	.remove = nau8821_i2c_remove,
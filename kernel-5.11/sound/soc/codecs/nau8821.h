@@ -216,6 +216,8 @@
 #define NAU8821_JACK_EJECT_DETECTED		(0x1 << 2)
 #define NAU8821_JACK_INSERT_IRQ_MASK	0x3
 #define NAU8821_JACK_INSERT_DETECTED	0x1
+/* bits the codec latches, each cleared by its own write in per-bit mode */
+#define NAU8821_IRQ_STATUS_MASK		0x3df
 
 /* INTERRUPT_DIS_CTRL (0x12) */
 #define NAU8821_IRQ_KEY_RELEASE_DIS	(0x1 << 7)
@@ -496,12 +498,293 @@ enum {
 	NAU8821_CLK_FLL_FS,
 };
 
+/* High-level operations accounted in the I2C statistics */
+enum nau8821_op {
+	NAU8821_OP_HW_PARAMS,
+	NAU8821_OP_FLL_APPLY,
+	NAU8821_OP_INTERRUPT,
+	NAU8821_OP_RESUME,
+	NAU8821_OP_INIT_REGS,
+	NAU8821_OP_HP_POWER_UP,
+	NAU8821_OP_SETUP_IRQ,
+	NAU8821_OP_EJECT_JACK,
+	NAU8821_OP_AUTO_IRQ,
+	NAU8821_OP_SNAPSHOT,
+	NAU8821_OP_NUM,
+};
+
+/* States of the jack detection state machine */
+enum nau8821_jack_state {
+	NAU8821_JACK_UNKNOWN,	/* manual mode, insertion and ejection armed */
+	NAU8821_JACK_EJECTED,	/* manual mode, waiting for an insertion */
+	NAU8821_JACK_ARMED,	/* auto mode on the running external clock */
+	NAU8821_JACK_DETECTING,	/* auto mode, jack type detection */
+	NAU8821_JACK_HEADPHONE,
+	NAU8821_JACK_HEADSET,
+	NAU8821_JACK_STATE_NUM,
+};
+
+/* Jack events decoded from IRQ_STATUS and the jack status */
+enum nau8821_jack_event {
+	NAU8821_JACK_EV_EJECT,
+	NAU8821_JACK_EV_INSERT,		/* insertion confirmed at manual mode */
+	NAU8821_JACK_EV_NO_JACK,	/* insertion IRQ without a jack */
+	NAU8821_JACK_EV_HEADPHONE,	/* type detected without microphone */
+	NAU8821_JACK_EV_HEADSET,	/* type detected with microphone */
+	NAU8821_JACK_EV_KEY_PRESS,
+	NAU8821_JACK_EV_KEY_RELEASE,
+	NAU8821_JACK_EV_NUM,
+};
+
+/* Jack type detections, timed from the first interruption to the report */
+enum nau8821_jack_det_path {
+	NAU8821_JACK_DET_TWO_PASS,	/* manual mode insertion, then auto mode */
+	NAU8821_JACK_DET_ONE_PASS,	/* insertion straight in armed auto mode */
+	NAU8821_JACK_DET_NUM,
+};
+
+/* Time stamps taken along a jack type detection */
+enum nau8821_jack_mark {
+	NAU8821_JACK_MARK_EDGE,		/* entry of the insertion interruption */
+	NAU8821_JACK_MARK_MANUAL,	/* manual mode insertion handled */
+	NAU8821_JACK_MARK_AUTO,		/* auto mode set up */
+	NAU8821_JACK_MARK_MIC_IRQ,	/* entry of the jack type interruption */
+	NAU8821_JACK_MARK_REPORT,	/* jack type reported */
+	NAU8821_JACK_MARK_NUM,
+};
+
+/* Detection stages, each between two of the time stamps */
+enum nau8821_jack_stage {
+	NAU8821_JACK_STAGE_MANUAL,
+	NAU8821_JACK_STAGE_AUTO_SETUP,
+	NAU8821_JACK_STAGE_MIC_DETECT,
+	NAU8821_JACK_STAGE_REPORT,
+	NAU8821_JACK_STAGE_TOTAL,
+	NAU8821_JACK_STAGE_NUM,
+};
+
+enum nau8821_jack_outcome {
+	NAU8821_JACK_OUT_HEADPHONE,
+	NAU8821_JACK_OUT_HEADSET,
+	NAU8821_JACK_OUT_NUM,
+};
+
+/* log2 buckets of microseconds, the last one catches everything above */
+#define NAU8821_HIST_BUCKETS	24
+
+struct nau8821_op_stats {
+	u64 calls;
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+	u64 total_ns;
+	u64 max_ns;
+	u32 hist[NAU8821_HIST_BUCKETS];
+};
+
+/* DAPM event callbacks timed by power direction */
+enum nau8821_dapm_ev {
+	NAU8821_DAPM_ADC,
+	NAU8821_DAPM_PUMP,
+	NAU8821_DAPM_HP_BOOST,
+	NAU8821_DAPM_OUTPUT_DAC,
+	NAU8821_DAPM_EV_NUM,
+};
+
+/* Snapshot of the bus totals taken when an operation starts */
+struct nau8821_op_ctx {
+	enum nau8821_op op;
+	int prev_io_op;
+	ktime_t start;
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+};
+
+/* Register I/O log, a ring of the last accesses, a power of two */
+#define NAU8821_IO_LOG_SIZE	1024
+
+/*
+ * One register access in the I/O log. The io_log debugfs node dumps the
+ * entries oldest first in this layout and the native byte order.
+ */
+struct nau8821_io_log_entry {
+	u64 ts_ns;	/* ktime_get_ns() after the transfer */
+	u32 seq;	/* running number of the access, from 1 */
+	u16 reg;
+	u16 val;
+	u8 write;	/* 1 - write, 0 - read */
+	u8 op;		/* enum nau8821_op in progress, NAU8821_OP_NUM for none */
+	u8 pad[6];
+};
+
+/*
+ * Binary register snapshot, as dumped by the regs_bin debugfs node: the
+ * header, num_runs run descriptors and then num_regs register values in
+ * run order. All fields are in the native byte order.
+ */
+#define NAU8821_SNAP_MAGIC	0x4e383231	/* "N821" */
+#define NAU8821_SNAP_VERSION	1
+
+struct nau8821_snap_hdr {
+	u32 magic;
+	u16 version;
+	u16 num_runs;
+	u64 ts_ns;	/* ktime_get_ns() at the start of the capture */
+	u32 num_regs;
+	u32 dur_ns;	/* time the capture took */
+};
+
+/* A run of consecutive readable registers with the same volatility */
+#define NAU8821_SNAP_RUN_VOLATILE	BIT(0)	/* read from the codec */
+#define NAU8821_SNAP_RUN_ERROR		BIT(1)	/* read failed, values are 0 */
+
+struct nau8821_snap_run {
+	u16 first;
+	u16 count;
+	u16 flags;
+	u16 pad;
+};
+
+struct nau8821_io_stats {
+	/* Bus totals, never reset so that operations can take deltas */
+	u64 reads;
+	u64 writes;
+	u64 bytes;
+	u32 reg_reads[NAU8821_REG_MAX + 1];
+	u32 reg_writes[NAU8821_REG_MAX + 1];
+	struct nau8821_op_stats op[NAU8821_OP_NUM];
+	/* interrupts by jack event, the no-ops counted separately too */
+	struct nau8821_op_stats jack_ev[NAU8821_JACK_EV_NUM];
+	u64 jack_noops[NAU8821_JACK_EV_NUM];
+	struct nau8821_op_stats jack_det[NAU8821_JACK_DET_NUM];
+	struct nau8821_op_stats
+		jack_stage[NAU8821_JACK_OUT_NUM][NAU8821_JACK_STAGE_NUM];
+	/* insertion interruptions without a jack plugged */
+	u64 jack_spurious;
+	/* DAPM event callbacks, [0] power up and [1] power down */
+	struct nau8821_op_stats dapm[NAU8821_DAPM_EV_NUM][2];
+};
+
+/* How IRQ_STATUS bits are acknowledged through INT_CLR_KEY_STATUS */
+enum nau8821_irq_clear_mode {
+	NAU8821_IRQ_CLEAR_PROBE,	/* bulk write, verified by a read back */
+	NAU8821_IRQ_CLEAR_BULK,		/* all active bits in one write */
+	NAU8821_IRQ_CLEAR_PER_BIT,	/* one write per active bit */
+};
+
+/* FLL reference inputs with separate lock time statistics */
+enum nau8821_fll_src {
+	NAU8821_FLL_SRC_MCLK,
+	NAU8821_FLL_SRC_BCLK,
+	NAU8821_FLL_SRC_FS,
+	NAU8821_FLL_SRC_NUM,
+};
+
+/* Settling time of the ADC input path before the ADCs are enabled */
+#define NAU8821_ADC_SETTLE_MS	125
+
+/* Longest wait for an asynchronous resume to restore the registers */
+#define NAU8821_RESUME_TIMEOUT_MS	1000
+
+/* Default longest wait of playback configuration for jack detection */
+#define NAU8821_JD_TIMEOUT_MS	1000
+
+/* Jack detection state gating the playback configuration */
+enum nau8821_jd_state {
+	NAU8821_JD_IDLE,	/* no detection, configuration goes ahead */
+	NAU8821_JD_DETECTING,	/* detection in flight, configuration waits */
+	NAU8821_JD_DONE,	/* jack type detected */
+};
+
+struct nau8821_jd_wait_stats {
+	u32 timeout_ms;
+	u64 calls;
+	u64 waits;
+	u64 timeouts;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+/* Default wait for the FLL to lock before switching to the VCO */
+#define NAU8821_FLL_SETTLE_US	2000
+
+struct nau8821_fll_lock_stats {
+	u32 settle_us;
+	u64 count;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+/* nau8821->irq when interruptions come from the register model */
+#define NAU8821_MODEL_IRQ	(-1)
+
+/* Status bits the register model raises */
+#define NAU8821_MODEL_IRQS	(NAU8821_KEY_IRQ_MASK | NAU8821_MIC_DETECT_IRQ | \
+	NAU8821_JACK_EJECT_DETECTED | NAU8821_JACK_INSERT_DETECTED)
+
+/* Time the register model takes for an auto mode detection */
+#define NAU8821_MODEL_DETECT_MS	20
+
+/* Jack and button events injected into the register model */
+enum nau8821_model_ev {
+	NAU8821_MODEL_EV_INSERT,	/* jack without a microphone */
+	NAU8821_MODEL_EV_INSERT_MIC,	/* jack with a microphone */
+	NAU8821_MODEL_EV_EJECT,
+	NAU8821_MODEL_EV_PRESS,
+	NAU8821_MODEL_EV_RELEASE,
+	NAU8821_MODEL_EV_NUM,
+};
+
+/*
+ * Behavioural model of the codec registers behind a RAM-backed regmap
+ * bus, standing in for the I2C codec in the KUnit tests of
+ * nau8821-test.c, see nau8821_model_probe(). CONFIG_SND_SOC_NAU8821_MODEL
+ * builds it, for test kernels only.
+ * It keeps the reset defaults, acknowledges IRQ_STATUS through the write
+ * 1 to clear INT_CLR_KEY_STATUS, and reflects the jack in the GPIO2 input
+ * of GENERAL_STATUS and the microphone in MICDET of I2C_DEVICE_ID.
+ */
+struct nau8821_model {
+	spinlock_t lock;	/* registers and jack */
+	u16 regs[NAU8821_REG_MAX + 1];
+	bool jack;		/* jack plugged */
+	bool mic;		/* the plugged jack has a microphone */
+	/* auto mode detection, completed after the debounce time */
+	struct delayed_work detect_work;
+	bool detecting;
+	/* delivery of the raised status to nau8821_interrupt() */
+	struct mutex irq_lock;
+	struct work_struct irq_work;
+	int irq_disabled;
+	u64 irqs;
+	struct nau8821 *nau8821;
+};
+#endif /* CONFIG_SND_SOC_NAU8821_MODEL */
+
+struct nau8821_fll {
+	int mclk_src;
+	int ratio;
+	int fll_frac;
+	int fll_int;
+	int clk_ref_div;
+};
+
 struct nau8821 {
 	struct device *dev;
 	struct regmap *regmap;
 	struct snd_soc_dapm_context *dapm;
 	struct snd_soc_jack *jack;
-	struct semaphore jd_sem;
+	/* jack detection gate, see nau8821_jd_wait() */
+	atomic_t jd_state;
+	struct completion jd_done;
+	struct nau8821_jd_wait_stats jd_wait;
+	/* serializes the clock and audio interface configuration */
+	struct mutex clk_lock;
+	/* bias level is ON, as seen by the jack detection under clk_lock */
+	bool bias_on;
 	int irq;
 	int clk_id;
 	int micbias_voltage;
@@ -512,9 +795,62 @@ struct nau8821 {
 	int jkdet_polarity;
 	int jack_insert_debounce;
 	int jack_eject_debounce;
+	/* jack state machine, changed by the interrupt thread only */
+	int jack_state;
+	/* jack status last reported, and the reports that repeated it */
+	int jack_report;
+	u64 jack_reports;
+	u64 jack_dup_reports;
+	u64 jack_insert_reports;	/* reports of a jack newly plugged */
+	/* time stamps of the detection in flight, jack_marks has them set */
+	struct nau8821_op_ctx jack_mark[NAU8821_JACK_MARK_NUM];
+	unsigned int jack_marks;
+	struct work_struct jack_disarm_work;
+	/* last FLL setting applied by nau8821_set_fll() */
+	struct nau8821_fll fll;
+	int fll_clk_id;
+	unsigned int fll_freq_in;
+	unsigned int fll_freq_out;
+	bool fll_valid;
+	struct nau8821_fll_lock_stats fll_lock[NAU8821_FLL_SRC_NUM];
+	/* headphone power-up from the charge pump to the last output stage */
+	struct nau8821_op_ctx hp_op;
+	bool hp_op_active;
+	enum nau8821_irq_clear_mode irq_clear_mode;
+	/* register restore after system resume, see async_resume */
+	struct work_struct resume_work;
+	struct completion resume_done;
+	/* cached registers at suspend, to find writes made while cache only */
+	u16 suspend_regs[NAU8821_REG_MAX + 1];
+	/* regmap cache only, see nau8821_cache_only() */
+	bool cache_only;
+	/* ADC channels waiting for the shared settling window */
+	struct delayed_work adc_work;
+	struct mutex adc_lock;
+	unsigned int adc_pending;
+	/* ADCL and ADCR widgets, checked before the deferred enable */
+	struct snd_soc_dapm_widget *adc_widget[2];
+	spinlock_t stats_lock;
+	struct nau8821_io_stats stats;
+	/* always on register I/O log and the operation it is attributed to */
+	struct nau8821_io_log_entry *io_log;
+	atomic_t io_log_seq;
+	int io_op;
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+	/* register model standing in for the codec, or NULL */
+	struct nau8821_model *model;
+#endif
 };
 
 int nau8821_enable_jack_detect(struct snd_soc_component *component,
 	struct snd_soc_jack *jack);
 
+#ifdef CONFIG_SND_SOC_NAU8821_MODEL
+struct nau8821 *nau8821_model_probe(struct device *dev);
+void nau8821_model_inject(struct nau8821 *nau8821, enum nau8821_model_ev ev);
+void nau8821_model_hold(struct nau8821 *nau8821, bool hold);
+void nau8821_model_power_loss(struct nau8821 *nau8821);
+unsigned int nau8821_model_reg(struct nau8821 *nau8821, unsigned int reg);
+#endif
+
 #endif  /* __NAU8821_H__ */